@@ -0,0 +1,60 @@
+#!/bin/bash
+#
+# Compares two sets of benchmark results written by `make run`:
+#
+#   compare.sh BASE.jsonl NEW.jsonl [THRESHOLD]
+#
+# Prints the change in median wall time, peak RSS and collections for each
+# benchmark in both sets.  A benchmark whose median wall time grew by more
+# than THRESHOLD percent, by default 5, is marked as a regression and the
+# script then exits with 1.
+
+if [ $# -lt 2 ] || [ $# -gt 3 ]; then
+  echo "Usage: $0 BASE.jsonl NEW.jsonl [THRESHOLD]" >&2
+  exit 2
+fi
+
+awk -v threshold="${3:-5}" '
+  function field(line, key,    start, rest) {
+    start = index(line, "\"" key "\": ")
+    if (start == 0)
+      return ""
+    rest = substr(line, start + length(key) + 4)
+    sub(/[,}].*/, "", rest)
+    gsub(/"/, "", rest)
+    return rest
+  }
+
+  function change(base, new) {
+    return base == 0 ? 0 : (new - base) * 100 / base
+  }
+
+  FNR == 1 { file += 1 }
+
+  {
+    name = field($0, "benchmark")
+    if (file == 1) {
+      wall[name] = field($0, "wall_ms_median")
+      rss[name] = field($0, "peak_rss_kb")
+      gcs[name] = field($0, "gc_collections")
+    } else if (name in wall) {
+      order[++count] = name
+      newWall[name] = field($0, "wall_ms_median")
+      newRss[name] = field($0, "peak_rss_kb")
+      newGcs[name] = field($0, "gc_collections")
+    }
+  }
+
+  END {
+    printf "%-12s %12s %12s %8s %10s %10s %8s %8s %8s\n", "benchmark", "base ms", "new ms", "change", "base kb", "new kb", "change", "base gc", "new gc"
+    for (i = 1; i <= count; i += 1) {
+      name = order[i]
+      wallChange = change(wall[name], newWall[name])
+      flag = wallChange > threshold ? "  REGRESSION" : ""
+      if (flag != "")
+        regressions += 1
+      printf "%-12s %12.1f %12.1f %+7.1f%% %10d %10d %+7.1f%% %8d %8d%s\n", name, wall[name], newWall[name], wallChange, rss[name], newRss[name], change(rss[name], newRss[name]), gcs[name], newGcs[name], flag
+    }
+    exit regressions > 0 ? 1 : 0
+  }
+' "$1" "$2"
@@ -0,0 +1,176 @@
+/* Runs a compiled benchmark a number of times and writes a single line of
+ * JSON describing the runs to stdout:
+ *
+ *   measure RUNS NAME PROGRAM
+ *
+ * Wall time is taken around each run and its minimum, median and maximum
+ * reported in milliseconds.  Peak RSS is the largest over the runs.  The
+ * collector's counts come from the report each run writes when MIL_GC_STATS
+ * names a file and are -1 for a program that does not write one.  The
+ * program's output is discarded and a run that does not exit with 0 fails
+ * the measurement.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/resource.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+
+#define MAX_RUNS 100
+
+struct Run
+{
+    double wall_ms;
+    long peak_rss_kb;
+    long collections;
+    long pause_us;
+    long allocated;
+};
+
+/* Finds "key": in the single line of JSON written by MIL_GC_STATS. */
+static long _stats_value(char *stats, char *key)
+{
+    char pattern[64];
+    snprintf(pattern, sizeof(pattern), "\"%s\": ", key);
+
+    char *p = strstr(stats, pattern);
+    return p == NULL ? -1 : strtol(p + strlen(pattern), NULL, 10);
+}
+
+static int _run(char *program, char *stats_file, struct Run *run)
+{
+    struct timespec start;
+    struct timespec end;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    pid_t pid = fork();
+
+    if (pid < 0)
+    {
+        perror("fork");
+        return 0;
+    }
+    if (pid == 0)
+    {
+        int null = open("/dev/null", O_WRONLY);
+
+        dup2(null, STDOUT_FILENO);
+        setenv("MIL_GC_STATS", stats_file, 1);
+        execl(program, program, (char *)NULL);
+        perror(program);
+        _exit(127);
+    }
+
+    int status;
+    struct rusage usage;
+
+    if (wait4(pid, &status, 0, &usage) < 0)
+    {
+        perror("wait4");
+        return 0;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    if (WIFSIGNALED(status))
+    {
+        fprintf(stderr, "%s: killed by signal %d\n", program, WTERMSIG(status));
+        return 0;
+    }
+    if (WEXITSTATUS(status) != 0)
+    {
+        fprintf(stderr, "%s: exited with %d\n", program, WEXITSTATUS(status));
+        return 0;
+    }
+
+    run->wall_ms = (end.tv_sec - start.tv_sec) * 1e3 + (end.tv_nsec - start.tv_nsec) / 1e6;
+#ifdef __APPLE__
+    run->peak_rss_kb = usage.ru_maxrss / 1024;
+#else
+    run->peak_rss_kb = usage.ru_maxrss;
+#endif
+
+    char stats[4096] = "";
+    FILE *f = fopen(stats_file, "r");
+
+    if (f != NULL)
+    {
+        size_t length = fread(stats, 1, sizeof(stats) - 1, f);
+        stats[length] = '\0';
+        fclose(f);
+    }
+    run->collections = _stats_value(stats, "collections");
+    run->pause_us = _stats_value(stats, "total_pause_us");
+    run->allocated = _stats_value(stats, "total_allocated");
+
+    return 1;
+}
+
+static int _compare_doubles(const void *a, const void *b)
+{
+    double da = *(double *)a;
+    double db = *(double *)b;
+
+    return da < db ? -1 : da > db ? 1 : 0;
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc != 4)
+    {
+        fprintf(stderr, "Usage: %s RUNS NAME PROGRAM\n", argv[0]);
+        return 1;
+    }
+
+    int runs = atoi(argv[1]);
+    char *name = argv[2];
+    char *program = argv[3];
+
+    if (runs < 1 || runs > MAX_RUNS)
+    {
+        fprintf(stderr, "%s: RUNS must be from 1 to %d\n", argv[0], MAX_RUNS);
+        return 1;
+    }
+
+    char stats_file[] = "/tmp/mil-bench-XXXXXX";
+    int fd = mkstemp(stats_file);
+
+    if (fd < 0)
+    {
+        perror("mkstemp");
+        return 1;
+    }
+    close(fd);
+
+    struct Run results[MAX_RUNS];
+    double wall_ms[MAX_RUNS];
+    long peak_rss_kb = 0;
+
+    for (int i = 0; i < runs; i += 1)
+    {
+        if (!_run(program, stats_file, &results[i]))
+        {
+            unlink(stats_file);
+            return 1;
+        }
+        wall_ms[i] = results[i].wall_ms;
+        if (results[i].peak_rss_kb > peak_rss_kb)
+            peak_rss_kb = results[i].peak_rss_kb;
+    }
+    unlink(stats_file);
+
+    qsort(wall_ms, runs, sizeof(double), _compare_doubles);
+    double median = runs % 2 == 1 ? wall_ms[runs / 2] : (wall_ms[runs / 2 - 1] + wall_ms[runs / 2]) / 2;
+
+    /* The collector's counts vary little between runs so the last run's are reported */
+    struct Run *last = &results[runs - 1];
+
+    printf("{\"benchmark\": \"%s\", \"runs\": %d, \"wall_ms_min\": %.3f, \"wall_ms_median\": %.3f, \"wall_ms_max\": %.3f, "
+           "\"peak_rss_kb\": %ld, \"gc_collections\": %ld, \"gc_pause_us\": %ld, \"gc_allocated_bytes\": %ld}\n",
+           name, runs, wall_ms[0], median, wall_ms[runs - 1], peak_rss_kb, last->collections, last->pause_us, last->allocated);
+
+    return 0;
+}
@@ -1,785 +1,2144 @@
 /* Library to link into compiled code
  */
 
-#include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <unwind.h>
 
 #include "./lib.h"
 #include "../../../bdwgc/include/gc.h"
 
-struct Value *_VNull;
-struct Value *_VTrue;
-struct Value *_VFalse;
+/* Output from print and println is collected in a buffer and written to
+ * stdout in large chunks rather than through a stdio call per token.  When
+ * stdout is a terminal, or MIL_LINE_BUFFERED is set, the buffer is also
+ * flushed at the end of every line so interactive output appears promptly.
+ * Whatever remains is written by _flush_output which must be called before
+ * the program exits.
+ */
+#define OUTPUT_BUFFER_SIZE 65536
+
+static char _output_buffer[OUTPUT_BUFFER_SIZE];
+static int _output_length = 0;
+static int _output_line_buffered = 0;
+
+static void _write_output(char *s, int length)
+{
+    while (length > 0)
+    {
+        ssize_t written = write(STDOUT_FILENO, s, length);
+
+        if (written < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return;
+        }
+        s += written;
+        length -= written;
+    }
+}
+
+void _flush_output(void)
+{
+    _write_output(_output_buffer, _output_length);
+    _output_length = 0;
+}
+
+static void _output_bytes(char *s, int length)
+{
+    if (_output_length + length > OUTPUT_BUFFER_SIZE)
+    {
+        _flush_output();
+
+        if (length > OUTPUT_BUFFER_SIZE)
+        {
+            _write_output(s, length);
+            return;
+        }
+    }
+
+    memcpy(_output_buffer + _output_length, s, length);
+    _output_length += length;
+}
+
+static void _output_string(char *s)
+{
+    _output_bytes(s, strlen(s));
+}
+
+static void _output_char(char c)
+{
+    if (_output_length == OUTPUT_BUFFER_SIZE)
+        _flush_output();
+
+    _output_buffer[_output_length++] = c;
+}
+
+static void _output_int(int v)
+{
+    char digits[12];
+    char *p = digits + sizeof(digits);
+    unsigned int u = v < 0 ? -(unsigned int)v : (unsigned int)v;
+
+    do
+    {
+        *--p = '0' + u % 10;
+        u /= 10;
+    } while (u != 0);
+
+    if (v < 0)
+        *--p = '-';
+
+    _output_bytes(p, digits + sizeof(digits) - p);
+}
+
+static void _output_newline(void)
+{
+    _output_char('\n');
+
+    if (_output_line_buffered)
+        _flush_output();
+}
+
+/* bdwgc has no need of a write barrier.  A collector that does, such as the
+ * generational collector in nursery.c, replaces this definition.
+ */
+__attribute__((weak)) void _gc_write_barrier(void *object)
+{
+}
+
+/* With MIL_ALLOCATION_PROFILE set every value allocated is counted against
+ * the position held in _allocation_file_name and _allocation_line_number and
+ * the value's tag.  A program compiled with --profile-allocations sets the
+ * position before each call it makes so a value allocated by the runtime is
+ * counted against the call that led to it.  The counts are written at exit
+ * sorted by bytes allocated to the named file or, when set to 1, to stderr.
+ */
+#define ALLOCATION_COUNTS_INITIAL_CAPACITY 1024
+
+char *_allocation_file_name = NULL;
+int _allocation_line_number = 0;
+
+struct AllocationCount
+{
+    char *file_name;
+    int line_number;
+    int tag;
+    unsigned long objects;
+    unsigned long bytes;
+};
+
+static int _allocation_profile = 0;
+static struct AllocationCount *_allocation_counts = NULL;
+static int _allocation_counts_size = 0;
+static int _allocation_counts_capacity = 0;
+
+static char *_value_type_name(int tag);
+
+static struct AllocationCount *_allocation_count(struct AllocationCount *counts, int capacity, char *file_name, int line_number, int tag)
+{
+    uintptr_t hash = ((uintptr_t)file_name ^ ((uintptr_t)line_number << 4) ^ (uintptr_t)tag) * 0x9e3779b97f4a7c15;
+    int index = (int)((hash >> 32) & (capacity - 1));
+
+    while (counts[index].objects != 0 &&
+           (counts[index].file_name != file_name || counts[index].line_number != line_number || counts[index].tag != tag))
+        index = (index + 1) & (capacity - 1);
+
+    return &counts[index];
+}
+
+static void _allocation_counts_grow(void)
+{
+    int capacity = _allocation_counts_capacity == 0 ? ALLOCATION_COUNTS_INITIAL_CAPACITY : _allocation_counts_capacity * 2;
+    struct AllocationCount *counts = calloc(capacity, sizeof(struct AllocationCount));
+
+    if (counts == NULL)
+    {
+        perror("MIL_ALLOCATION_PROFILE");
+        exit(1);
+    }
+
+    for (int i = 0; i < _allocation_counts_capacity; i += 1)
+        if (_allocation_counts[i].objects != 0)
+            *_allocation_count(counts, capacity, _allocation_counts[i].file_name, _allocation_counts[i].line_number, _allocation_counts[i].tag) = _allocation_counts[i];
+
+    free(_allocation_counts);
+    _allocation_counts = counts;
+    _allocation_counts_capacity = capacity;
+}
+
+static void _record_allocation(int tag, size_t bytes)
+{
+    if (4 * (_allocation_counts_size + 1) > 3 * _allocation_counts_capacity)
+        _allocation_counts_grow();
+
+    struct AllocationCount *count = _allocation_count(_allocation_counts, _allocation_counts_capacity, _allocation_file_name, _allocation_line_number, tag);
+
+    if (count->objects == 0)
+    {
+        count->file_name = _allocation_file_name;
+        count->line_number = _allocation_line_number;
+        count->tag = tag;
+        _allocation_counts_size += 1;
+    }
+    count->objects += 1;
+    count->bytes += bytes;
+}
+
+static inline void *_allocate(int tag, size_t bytes)
+{
+    if (__builtin_expect(_allocation_profile, 0))
+        _record_allocation(tag, bytes);
+
+    return GC_MALLOC(bytes);
+}
+
+static inline void *_allocate_atomic(int tag, size_t bytes)
+{
+    if (__builtin_expect(_allocation_profile, 0))
+        _record_allocation(tag, bytes);
+
+    return GC_MALLOC_ATOMIC(bytes);
+}
+
+static int _compare_allocation_counts(const void *a, const void *b)
+{
+    unsigned long bytes_a = ((struct AllocationCount *)a)->bytes;
+    unsigned long bytes_b = ((struct AllocationCount *)b)->bytes;
+
+    return bytes_a < bytes_b ? 1 : bytes_a > bytes_b ? -1 : 0;
+}
+
+static void _report_allocations(void)
+{
+    char *destination = getenv("MIL_ALLOCATION_PROFILE");
+    FILE *out = destination[0] == '\0' || (destination[0] == '1' && destination[1] == '\0') ? stderr : fopen(destination, "w");
+
+    if (out == NULL)
+    {
+        perror(destination);
+        return;
+    }
+
+    int size = 0;
+    unsigned long total_objects = 0;
+    unsigned long total_bytes = 0;
+
+    for (int i = 0; i < _allocation_counts_capacity; i += 1)
+        if (_allocation_counts[i].objects != 0)
+            _allocation_counts[size++] = _allocation_counts[i];
+    qsort(_allocation_counts, size, sizeof(struct AllocationCount), _compare_allocation_counts);
+
+    fprintf(out, "%14s %12s  %-24s %s\n", "bytes", "objects", "site", "value");
+    for (int i = 0; i < size; i += 1)
+    {
+        struct AllocationCount *count = &_allocation_counts[i];
+        char site[256];
+
+        if (count->file_name == NULL)
+            snprintf(site, sizeof(site), "(runtime)");
+        else
+            snprintf(site, sizeof(site), "%s:%d", count->file_name, count->line_number);
+
+        fprintf(out, "%14lu %12lu  %-24s %s\n", count->bytes, count->objects, site, _value_type_name(count->tag));
+        total_objects += count->objects;
+        total_bytes += count->bytes;
+    }
+    fprintf(out, "%14lu %12lu  total\n", total_bytes, total_objects);
+
+    if (out != stderr)
+        fclose(out);
+}
 
 void _initialise_lib()
 {
-    _VNull = (struct Value *)GC_MALLOC(sizeof(struct Value));
-    _VNull->tag = NULL_VALUE;
+    _output_line_buffered = isatty(STDOUT_FILENO) || getenv("MIL_LINE_BUFFERED") != NULL;
+
+    if (getenv("MIL_ALLOCATION_PROFILE") != NULL)
+    {
+        _allocation_profile = 1;
+        _allocation_counts_grow();
+        atexit(_report_allocations);
+    }
+}
+
+static int _value_tag(struct Value *value)
+{
+    switch (IMMEDIATE_TAG(value))
+    {
+    case POINTER_IMMEDIATE:
+        return value->tag;
+    case INTEGER_IMMEDIATE:
+        return INTEGER_VALUE;
+    case CHARACTER_IMMEDIATE:
+        return CHARACTER_VALUE;
+    default:
+        return value == _VNull ? NULL_VALUE : BOOLEAN_VALUE;
+    }
+}
+
+/* _print_value and _equals walk values with an explicit work stack rather
+ * than by recursion so that deeply nested values cannot overflow the native
+ * stack.  The stack starts in the caller's frame and only moves to the C
+ * heap for values nested more deeply than WORK_STACK_INITIAL_SIZE allows.
+ * Everything on it is reachable from the values being walked so it need
+ * not be scanned by the collector.
+ *
+ * Markers are constant immediates that no program can construct.  They
+ * record what remains to be done once the value above them has been
+ * handled.
+ */
+#define WORK_STACK_INITIAL_SIZE 64
+
+#define LIST_REST_MARKER MK_IMMEDIATE(16, CONSTANT_IMMEDIATE)
+#define VECTOR_REST_MARKER MK_IMMEDIATE(17, CONSTANT_IMMEDIATE)
+#define CLOSE_MARKER MK_IMMEDIATE(18, CONSTANT_IMMEDIATE)
+#define MAP_REST_MARKER MK_IMMEDIATE(19, CONSTANT_IMMEDIATE)
+#define DOT_MARKER MK_IMMEDIATE(20, CONSTANT_IMMEDIATE)
 
-    _VTrue = (struct Value *)GC_MALLOC(sizeof(struct Value));
-    _VTrue->tag = BOOLEAN_VALUE;
-    _VTrue->boolean = (1 == 1);
+struct WorkStack
+{
+    struct Value **items;
+    int length;
+    int capacity;
+    struct Value *initial[WORK_STACK_INITIAL_SIZE];
+};
 
-    _VFalse = (struct Value *)GC_MALLOC(sizeof(struct Value));
-    _VFalse->tag = BOOLEAN_VALUE;
-    _VFalse->boolean = (1 == 0);
+static void _work_stack_initialise(struct WorkStack *stack)
+{
+    stack->items = stack->initial;
+    stack->length = 0;
+    stack->capacity = WORK_STACK_INITIAL_SIZE;
 }
 
+static void _work_stack_push(struct WorkStack *stack, struct Value *value)
+{
+    if (stack->length == stack->capacity)
+    {
+        int capacity = stack->capacity * 2;
+        struct Value **items = (struct Value **)malloc(sizeof(struct Value *) * capacity);
+
+        memcpy(items, stack->items, sizeof(struct Value *) * stack->length);
+        if (stack->items != stack->initial)
+            free(stack->items);
+
+        stack->items = items;
+        stack->capacity = capacity;
+    }
+
+    stack->items[stack->length++] = value;
+}
+
+static struct Value *_work_stack_pop(struct WorkStack *stack)
+{
+    return stack->items[--stack->length];
+}
+
+static void _work_stack_release(struct WorkStack *stack)
+{
+    if (stack->items != stack->initial)
+        free(stack->items);
+}
+
+#define HASHMAP_LIVE(entry) ((entry)->key != NULL && (entry)->key != HASHMAP_TOMBSTONE)
+
+static struct HashMapTable *_hashmap_reroot(struct HashMap *map);
+
+/* Starts printing the first entry of map at or after index, leaving the
+ * rest of the map beneath a MAP_REST_MARKER, or closes the map when there
+ * are no more entries.
+ */
+static void _print_map_entry(struct WorkStack *stack, struct HashMap *map, int index, char *open)
+{
+    struct HashMapTable *table = _hashmap_reroot(map);
+
+    while (index < table->capacity && !HASHMAP_LIVE(table->entries + index))
+        index += 1;
+
+    if (index < table->capacity)
+    {
+        _output_string(open);
+        _work_stack_push(stack, FROM_INTEGER(index + 1));
+        _work_stack_push(stack, (struct Value *)map);
+        _work_stack_push(stack, MAP_REST_MARKER);
+        _work_stack_push(stack, CLOSE_MARKER);
+        _work_stack_push(stack, table->entries[index].value);
+        _work_stack_push(stack, DOT_MARKER);
+        _work_stack_push(stack, table->entries[index].key);
+    }
+    else
+        _output_char(')');
+}
+
+/* A list is printed an element at a time: its first element is pushed
+ * above a LIST_REST_MARKER and the rest of the list so a long list needs no
+ * more of the stack than a short one.  Vectors do the same, keeping the
+ * index of the next item below their VECTOR_REST_MARKER and maps the index
+ * of their next entry below a MAP_REST_MARKER.
+ */
 void _print_value(char *file_name, int line_number, struct Value *value)
 {
-    switch (value->tag)
+    struct WorkStack stack;
+
+    _work_stack_initialise(&stack);
+    _work_stack_push(&stack, value);
+
+    while (stack.length > 0)
     {
-    case NULL_VALUE:
-        printf("()");
-        break;
-    case BOOLEAN_VALUE:
-        if (value->boolean)
-            printf("#t");
+        value = _work_stack_pop(&stack);
+
+        if (value == LIST_REST_MARKER)
+        {
+            struct Value *runner = _work_stack_pop(&stack);
+
+            if (IS_POINTER(runner) && runner->tag == PAIR_VALUE)
+            {
+                _output_char(' ');
+                _work_stack_push(&stack, AS_PAIR(runner)->cdr);
+                _work_stack_push(&stack, LIST_REST_MARKER);
+                _work_stack_push(&stack, AS_PAIR(runner)->car);
+            }
+            else if (runner == _VNull)
+                _output_char(')');
+            else
+            {
+                _output_string(" . ");
+                _work_stack_push(&stack, CLOSE_MARKER);
+                _work_stack_push(&stack, runner);
+            }
+            continue;
+        }
+        if (value == VECTOR_REST_MARKER)
+        {
+            struct Vector *vector = AS_VECTOR(_work_stack_pop(&stack));
+            int index = INTEGER_OF(_work_stack_pop(&stack));
+
+            if (index < vector->length)
+            {
+                _output_char(' ');
+                _work_stack_push(&stack, FROM_INTEGER(index + 1));
+                _work_stack_push(&stack, (struct Value *)vector);
+                _work_stack_push(&stack, VECTOR_REST_MARKER);
+                _work_stack_push(&stack, vector->items[index]);
+            }
+            else
+                _output_char(')');
+            continue;
+        }
+        if (value == MAP_REST_MARKER)
+        {
+            struct HashMap *map = AS_HASHMAP(_work_stack_pop(&stack));
+
+            _print_map_entry(&stack, map, INTEGER_OF(_work_stack_pop(&stack)), " (");
+            continue;
+        }
+        if (value == DOT_MARKER)
+        {
+            _output_string(" . ");
+            continue;
+        }
+        if (value == CLOSE_MARKER)
+        {
+            _output_char(')');
+            continue;
+        }
+
+        switch (_value_tag(value))
+        {
+        case NULL_VALUE:
+            _output_string("()");
+            break;
+        case BOOLEAN_VALUE:
+            if (value == _VTrue)
+                _output_string("#t");
+            else
+                _output_string("#f");
+            break;
+        case INTEGER_VALUE:
+            _output_int(INTEGER_OF(value));
+            break;
+        case CHARACTER_VALUE:
+            _output_char(CHARACTER_OF(value));
+            break;
+        case STRING_VALUE:
+            _output_bytes(AS_STRING(value)->string, AS_STRING(value)->length);
+            break;
+        case PAIR_VALUE:
+            _output_char('(');
+            _work_stack_push(&stack, AS_PAIR(value)->cdr);
+            _work_stack_push(&stack, LIST_REST_MARKER);
+            _work_stack_push(&stack, AS_PAIR(value)->car);
+            break;
+        case VECTOR_VALUE:
+            _output_string("#(");
+            if (AS_VECTOR(value)->length == 0)
+                _output_char(')');
+            else
+            {
+                _work_stack_push(&stack, FROM_INTEGER(1));
+                _work_stack_push(&stack, value);
+                _work_stack_push(&stack, VECTOR_REST_MARKER);
+                _work_stack_push(&stack, AS_VECTOR(value)->items[0]);
+            }
+            break;
+        case SYMBOL_VALUE:
+            _output_bytes(AS_STRING(AS_SYMBOL(value)->name)->string, AS_STRING(AS_SYMBOL(value)->name)->length);
+            break;
+        case HASHMAP_VALUE:
+            _output_string("#map(");
+            _print_map_entry(&stack, AS_HASHMAP(value), 0, "(");
+            break;
+        case INT32_ARRAY_VALUE:
+        {
+            struct Int32Array *array = AS_INT32_ARRAY(value);
+
+            _output_string("#i32(");
+            for (int i = 0; i < array->length; i += 1)
+            {
+                if (i > 0)
+                    _output_char(' ');
+                _output_int(array->items[i]);
+            }
+            _output_char(')');
+            break;
+        }
+        case CLOSURE_VALUE:
+            _output_string("#CLOSURE/");
+            _output_int(AS_CLOSURE(value)->number_arguments);
+            break;
+        default:
+            _work_stack_release(&stack);
+            _exception_throw(file_name, line_number,
+                             _mk_pair(
+                                 _from_literal_string("InternalError"),
+                                 _mk_pair(
+                                     _mk_pair(_from_literal_string("reason"), _from_literal_string("UnknownTag")),
+                                     _mk_pair(
+                                         _mk_pair(_from_literal_string("tag"), _from_literal_int(value->tag)),
+                                         _VNull))));
+        }
+    }
+
+    _work_stack_release(&stack);
+}
+
+struct Value *_from_literal_int(int v)
+{
+    return FROM_INTEGER(v);
+}
+
+struct Value *_mk_string(char *s, int length)
+{
+    struct StringValue *r = (struct StringValue *)_allocate_atomic(STRING_VALUE, sizeof(struct StringValue) + length + 1);
+    r->tag = STRING_VALUE;
+    r->length = length;
+    memcpy(r->string, s, length);
+    r->string[length] = '\0';
+    return (struct Value *)r;
+}
+
+struct Value *_from_literal_string(char *s)
+{
+    return _mk_string(s, strlen(s));
+}
+
+struct Value *_from_dynamic_procedure(void *procedure, int number_arguments, struct Value *frame)
+{
+    struct Closure *r = (struct Closure *)_allocate(CLOSURE_VALUE, sizeof(struct Closure));
+    r->tag = CLOSURE_VALUE;
+    r->number_arguments = number_arguments;
+    r->entry = procedure;
+    r->generic = _closure_argument_mismatch;
+    r->frame = frame;
+
+    return (struct Value *)r;
+}
+
+struct Value *_mk_frame(struct Value *parent, int size)
+{
+    struct Vector *frame = (struct Vector *)_allocate(FRAME_VALUE, sizeof(struct Vector) + sizeof(struct Value *) * (1 + size));
+    frame->tag = FRAME_VALUE;
+    frame->length = 1 + size;
+    frame->items[0] = parent;
+
+    while (size > 0)
+    {
+        frame->items[size] = _VNull;
+        size -= 1;
+    }
+
+    return (struct Value *)frame;
+}
+
+/* Environments hold the values captured by a flat closure and, with a single
+ * item, serve as the box for a captured value that is assigned after capture.
+ */
+struct Value *_mk_environment(int size)
+{
+    struct Vector *environment = (struct Vector *)_allocate(FRAME_VALUE, sizeof(struct Vector) + sizeof(struct Value *) * size);
+    environment->tag = FRAME_VALUE;
+    environment->length = size;
+
+    while (size > 0)
+    {
+        size -= 1;
+        environment->items[size] = _VNull;
+    }
+
+    return (struct Value *)environment;
+}
+
+struct Value *_get_frame(struct Value *frame, int depth)
+{
+    while (depth > 0)
+    {
+        frame = AS_VECTOR(frame)->items[0];
+        depth -= 1;
+    }
+    return frame;
+}
+
+struct Value *_get_frame_value(struct Value *frame, int depth, int offset)
+{
+    return AS_VECTOR(_get_frame(frame, depth))->items[offset];
+}
+
+void _set_frame_value(struct Value *frame, int depth, int offset, struct Value *value)
+{
+    while (depth > 0)
+    {
+        frame = AS_VECTOR(frame)->items[0];
+        depth -= 1;
+    }
+    AS_VECTOR(frame)->items[offset] = value;
+    _gc_write_barrier(frame);
+}
+
+/* The slow path of a call through a closure: the compiler enters a closure
+ * directly when it is passed the number of arguments it expects.
+ */
+struct Value *_call_closure(char *file_name, int line_number, struct Value *closure, int argc, struct Value **argv)
+{
+    int tag = _value_tag(closure);
+
+    if (tag != CLOSURE_VALUE)
+    {
+        _exception_throw(file_name, line_number,
+                         _mk_pair(
+                             _from_literal_string("NotClosure"),
+                             _mk_pair(
+                                 _mk_pair(_from_literal_string("reason"), _from_literal_string("Attempt to call value as if a closure")),
+                                 _mk_pair(
+                                     _mk_pair(_from_literal_string("tag"), _from_literal_int(tag)),
+                                     _VNull))));
+    }
+
+    return AS_CLOSURE(closure)->generic(file_name, line_number, argc, argv, closure);
+}
+
+struct Value *_closure_argument_mismatch(char *file_name, int line_number, int argc, struct Value **argv, struct Value *closure)
+{
+    _exception_throw(file_name, line_number,
+                     _mk_pair(
+                         _from_literal_string("ArgumentCountMismatch"),
+                         _mk_pair(
+                             _mk_pair(_from_literal_string("reason"), _from_literal_string("Argument mismatch")),
+                             _mk_pair(
+                                 _mk_pair(_from_literal_string("received"), _from_literal_int(argc)),
+                                 _mk_pair(
+                                     _mk_pair(_from_literal_string("expected"), _from_literal_int(AS_CLOSURE(closure)->number_arguments)),
+                                     _VNull)))));
+
+    return _VNull;
+}
+
+struct Value *_call_native_var_arg(char *file_name, int line_number, int argc, struct Value **argv, struct Value *closure)
+{
+    struct Value *(*f)(int, struct Value **) = AS_CLOSURE(closure)->entry;
+
+    return f(argc, argv);
+}
+
+/* Natives that report errors are passed the position of the call. */
+struct Value *_call_native_var_arg_position(char *file_name, int line_number, int argc, struct Value **argv, struct Value *closure)
+{
+    struct Value *(*f)(char *, int, int, struct Value **) = AS_CLOSURE(closure)->entry;
+
+    return f(file_name, line_number, argc, argv);
+}
+
+struct Value *_mk_pair(struct Value *car, struct Value *cdr)
+{
+    struct Pair *r = (struct Pair *)_allocate(PAIR_VALUE, sizeof(struct Pair));
+    r->tag = PAIR_VALUE;
+    r->car = car;
+    r->cdr = cdr;
+    return (struct Value *)r;
+}
+
+void _print_newline(void)
+{
+    _output_newline();
+}
+
+/* Integer arithmetic is 32-bit two's complement so it is performed on
+ * unsigned values to wrap without relying on signed overflow.
+ */
+struct Value *_plus(struct Value *op1, struct Value *op2)
+{
+    int v1 = IS_INTEGER(op1) ? INTEGER_OF(op1) : 0;
+
+    if (v1 == 0)
+        return op2;
+    else
+    {
+        int v2 = IS_INTEGER(op2) ? INTEGER_OF(op2) : 0;
+        if (v2 == 0)
+            return op1;
         else
-            printf("#f");
-        break;
-    case INTEGER_VALUE:
-        printf("%d", value->integer);
-        break;
+            return FROM_INTEGER((unsigned int)v1 + (unsigned int)v2);
+    }
+}
+
+struct Value *_minus(struct Value *op1, struct Value *op2)
+{
+    int v2 = IS_INTEGER(op2) ? INTEGER_OF(op2) : 0;
+    if (v2 == 0)
+        return op1;
+    else
+    {
+        int v1 = IS_INTEGER(op1) ? INTEGER_OF(op1) : 0;
+        return FROM_INTEGER((unsigned int)v1 - (unsigned int)v2);
+    }
+}
+
+struct Value *_multiply(struct Value *op1, struct Value *op2)
+{
+    int v1 = IS_INTEGER(op1) ? INTEGER_OF(op1) : 0;
+
+    if (v1 == 0)
+        return FROM_INTEGER(0);
+    else
+    {
+        int v2 = IS_INTEGER(op2) ? INTEGER_OF(op2) : 0;
+        if (v2 == 0)
+            return FROM_INTEGER(0);
+        else
+            return FROM_INTEGER((unsigned int)v1 * (unsigned int)v2);
+    }
+}
+
+struct Value *_divide(char *file_name, int line_number, struct Value *op1, struct Value *op2)
+{
+    int v1 = IS_INTEGER(op1) ? INTEGER_OF(op1) : 0;
+    int v2 = IS_INTEGER(op2) ? INTEGER_OF(op2) : 0;
+
+    if (v2 == 0)
+    {
+        _exception_throw(file_name, line_number, _from_literal_string("DivideByZero"));
+    }
+
+    return FROM_INTEGER((int)(v1 / v2));
+}
+
+/* Strings of different lengths are never equal so memcmp is only reached
+ * when the lengths agree.
+ */
+static int _equal_strings(struct StringValue *s1, struct StringValue *s2)
+{
+    return s1->length == s2->length && memcmp(s1->string, s2->string, s1->length) == 0;
+}
+
+static int _compare_strings(struct StringValue *s1, struct StringValue *s2)
+{
+    int length = s1->length < s2->length ? s1->length : s2->length;
+    int result = memcmp(s1->string, s2->string, length);
+
+    return result != 0 ? result : s1->length - s2->length;
+}
+
+/* Hash maps use open addressing with linear probing over a table of entries
+ * stored inline, so a lookup usually touches a single cache line.  A table
+ * is kept at most half full, counting removed entries, and is replaced by
+ * one with room for as many entries again when it would fill.  Equal values
+ * hash alike - structural hashes look at
+ * no more than HASH_DEPTH levels and HASH_LENGTH elements of each level,
+ * which keeps hashing cheap without breaking that.
+ */
+#define HASH_DEPTH 4
+#define HASH_LENGTH 16
+#define HASH_MIX(h, v) (((h) ^ (uintptr_t)(v)) * 0x100000001b3)
+
+static uintptr_t _hash_value(struct Value *v, int depth)
+{
+    if (!IS_POINTER(v))
+        return HASH_MIX(0xcbf29ce484222325, v);
+
+    uintptr_t h = HASH_MIX(0xcbf29ce484222325, v->tag);
+
+    switch (v->tag)
+    {
     case STRING_VALUE:
-        printf("%s", value->string);
-        break;
+        for (int i = 0; i < AS_STRING(v)->length; i += 1)
+            h = HASH_MIX(h, (unsigned char)AS_STRING(v)->string[i]);
+        return h;
+    case INT32_ARRAY_VALUE:
+        for (int i = 0; i < AS_INT32_ARRAY(v)->length; i += 1)
+            h = HASH_MIX(h, (uint32_t)AS_INT32_ARRAY(v)->items[i]);
+        return h;
     case PAIR_VALUE:
+        if (depth > 0)
+        {
+            int n = 0;
+            for (; IS_POINTER(v) && v->tag == PAIR_VALUE && n < HASH_LENGTH; v = AS_PAIR(v)->cdr, n += 1)
+                h = HASH_MIX(h, _hash_value(AS_PAIR(v)->car, depth - 1));
+            if (n < HASH_LENGTH)
+                h = HASH_MIX(h, _hash_value(v, depth - 1));
+        }
+        return h;
+    case VECTOR_VALUE:
+        h = HASH_MIX(h, AS_VECTOR(v)->length);
+        if (depth > 0)
+            for (int i = 0; i < AS_VECTOR(v)->length && i < HASH_LENGTH; i += 1)
+                h = HASH_MIX(h, _hash_value(AS_VECTOR(v)->items[i], depth - 1));
+        return h;
+    case SYMBOL_VALUE:
+        return HASH_MIX(h, AS_SYMBOL(v)->hash);
+    case HASHMAP_VALUE:
+        return HASH_MIX(h, AS_HASHMAP(v)->size);
+    default:
+        return HASH_MIX(h, v);
+    }
+}
+
+/* Multiplication only carries differences upwards so the hash is folded
+ * back down before its low bits are used to pick an entry.  Symbols carry
+ * their hash so looking one up never touches its name.
+ */
+static uintptr_t _hash_key(struct Value *key)
+{
+    if (IS_POINTER(key) && key->tag == SYMBOL_VALUE)
+        return AS_SYMBOL(key)->hash;
+
+    uintptr_t h = _hash_value(key, HASH_DEPTH);
+
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccd;
+    h ^= h >> 33;
+
+    return h;
+}
+
+/* The entry holding key or NULL when key is absent.  capacity is a power of
+ * two and at least one entry is always empty so the probe ends.
+ */
+static struct HashMapEntry *_hashmap_find(struct HashMapEntry *entries, int capacity, struct Value *key, uintptr_t hash)
+{
+    uintptr_t mask = capacity - 1;
+
+    for (uintptr_t i = hash & mask;; i = (i + 1) & mask)
     {
-        printf("(");
-        _print_value(file_name, line_number, value->pair.car);
+        struct HashMapEntry *entry = entries + i;
 
-        struct Value *runner = value->pair.cdr;
+        if (entry->key == NULL)
+            return NULL;
+        if (entry->key == key || (entry->key != HASHMAP_TOMBSTONE && entry->hash == hash && IS_POINTER(key) && _equals(entry->key, key) == _VTrue))
+            return entry;
+    }
+}
 
-        while (1)
+/* The entries of map's version without making it current, so that comparing
+ * it never disturbs a version of the same map being probed.  When *copied is
+ * set the entries are a copy that the caller frees.
+ */
+static struct HashMapEntry *_hashmap_view(struct HashMap *map, int *capacity, int *copied)
+{
+    struct HashMap *current = map;
+
+    while (current->table == NULL)
+        current = current->next;
+
+    *capacity = current->table->capacity;
+    *copied = current != map;
+    if (current == map)
+        return map->table->entries;
+
+    struct HashMapEntry *entries = malloc(sizeof(struct HashMapEntry) * *capacity);
+    char *recorded = calloc(*capacity, 1);
+
+    if (entries == NULL || recorded == NULL)
+    {
+        perror("_hashmap_view");
+        exit(1);
+    }
+    memcpy(entries, current->table->entries, sizeof(struct HashMapEntry) * *capacity);
+
+    /* The version nearest map to record a slot holds map's entry */
+    for (struct HashMap *version = map; version != current; version = version->next)
+        if (!recorded[version->slot])
+        {
+            entries[version->slot] = version->entry;
+            recorded[version->slot] = 1;
+        }
+    free(recorded);
+
+    return entries;
+}
+
+/* Values are compared a pair of operands at a time.  The cdrs of two pairs
+ * are pushed while their cars are compared straight away so comparing long
+ * lists takes no more of the stack than comparing short ones.  Vectors push
+ * the index of their next items beneath a VECTOR_REST_MARKER.  Maps push the
+ * values of each of their keys.  Symbols are interned so two symbols are
+ * equal only when they are identical.
+ */
+struct Value *_equals(struct Value *op1, struct Value *op2)
+{
+    struct WorkStack stack;
+    int result = 1;
+
+    _work_stack_initialise(&stack);
+
+    while (1)
+    {
+        if (op1 == VECTOR_REST_MARKER)
         {
-            if (runner->tag == PAIR_VALUE)
+            int index = INTEGER_OF(op2);
+            struct Vector *v2 = AS_VECTOR(_work_stack_pop(&stack));
+            struct Vector *v1 = AS_VECTOR(_work_stack_pop(&stack));
+
+            if (index < v1->length)
             {
-                printf(" ");
-                _print_value(file_name, line_number, runner->pair.car);
-                runner = runner->pair.cdr;
+                _work_stack_push(&stack, (struct Value *)v1);
+                _work_stack_push(&stack, (struct Value *)v2);
+                _work_stack_push(&stack, VECTOR_REST_MARKER);
+                _work_stack_push(&stack, FROM_INTEGER(index + 1));
+                op1 = v1->items[index];
+                op2 = v2->items[index];
+                continue;
             }
-            else if (runner->tag == NULL_VALUE)
+        }
+        else if (op1 != op2)
+        {
+            if (!IS_POINTER(op1) || !IS_POINTER(op2) || op1->tag != op2->tag)
+            {
+                result = 0;
                 break;
-            else
+            }
+
+            switch (op1->tag)
+            {
+            case STRING_VALUE:
+                result = _equal_strings(AS_STRING(op1), AS_STRING(op2));
+                break;
+            case PAIR_VALUE:
+                _work_stack_push(&stack, AS_PAIR(op1)->cdr);
+                _work_stack_push(&stack, AS_PAIR(op2)->cdr);
+                op1 = AS_PAIR(op1)->car;
+                op2 = AS_PAIR(op2)->car;
+                continue;
+            case VECTOR_VALUE:
+                if (AS_VECTOR(op1)->length != AS_VECTOR(op2)->length)
+                    result = 0;
+                else if (AS_VECTOR(op1)->length > 0)
+                {
+                    _work_stack_push(&stack, op1);
+                    _work_stack_push(&stack, op2);
+                    _work_stack_push(&stack, VECTOR_REST_MARKER);
+                    _work_stack_push(&stack, FROM_INTEGER(1));
+                    op1 = AS_VECTOR(op1)->items[0];
+                    op2 = AS_VECTOR(op2)->items[0];
+                    continue;
+                }
+                break;
+            case HASHMAP_VALUE:
             {
-                printf(" . ");
-                _print_value(file_name, line_number, runner);
+                struct HashMap *m1 = AS_HASHMAP(op1);
+                struct HashMap *m2 = AS_HASHMAP(op2);
+
+                result = m1->size == m2->size;
+                if (result)
+                {
+                    int capacity1, capacity2, copied1, copied2;
+                    struct HashMapEntry *entries1 = _hashmap_view(m1, &capacity1, &copied1);
+                    struct HashMapEntry *entries2 = _hashmap_view(m2, &capacity2, &copied2);
+
+                    for (int i = 0; result && i < capacity1; i += 1)
+                        if (HASHMAP_LIVE(entries1 + i))
+                        {
+                            struct HashMapEntry *entry = _hashmap_find(entries2, capacity2, entries1[i].key, entries1[i].hash);
+
+                            if (entry == NULL)
+                                result = 0;
+                            else
+                            {
+                                _work_stack_push(&stack, entries1[i].value);
+                                _work_stack_push(&stack, entry->value);
+                            }
+                        }
+
+                    if (copied1)
+                        free(entries1);
+                    if (copied2)
+                        free(entries2);
+                }
                 break;
             }
+            case INT32_ARRAY_VALUE:
+                result = AS_INT32_ARRAY(op1)->length == AS_INT32_ARRAY(op2)->length &&
+                         memcmp(AS_INT32_ARRAY(op1)->items, AS_INT32_ARRAY(op2)->items, sizeof(int32_t) * AS_INT32_ARRAY(op1)->length) == 0;
+                break;
+            default:
+                result = 0;
+                break;
+            }
+
+            if (!result)
+                break;
         }
-        printf(")");
-        break;
-    }
-    case NATIVE_CLOSURE_VALUE:
-        printf("#NATIVE_CLOSURE/%d", value->native_closure.number_arguments);
-        break;
-    case NATIVE_VAR_ARG_CLOSURE_VALUE:
-        printf("#NATIVE_VAR_ARG_CLOSURE");
-        break;
-    case NATIVE_VAR_ARG_CLOSURE_POSITION_VALUE:
-        printf("#NATIVE_VAR_ARG_POSITION_CLOSURE/%s/%d", value->native_var_arg_closure_position.file_name, value->native_var_arg_closure_position.line_number);
-        break;
-    case DYNAMIC_CLOSURE_VALUE:
-        printf("#DYNAMIC_CLOSURE/%d", value->dynamic_closure.number_arguments);
-        break;
+
+        if (stack.length == 0)
+            break;
+
+        op2 = _work_stack_pop(&stack);
+        op1 = _work_stack_pop(&stack);
+    }
+
+    _work_stack_release(&stack);
+
+    return result ? _VTrue : _VFalse;
+}
+
+struct Value *_less_than(struct Value *op1, struct Value *op2)
+{
+    int tag = _value_tag(op1);
+
+    if (tag != _value_tag(op2))
+        return _VFalse;
+
+    switch (tag)
+    {
+    case BOOLEAN_VALUE:
+        return ((op1 == _VTrue) < (op2 == _VTrue)) ? _VTrue : _VFalse;
+    case INTEGER_VALUE:
+    case CHARACTER_VALUE:
+        return (((intptr_t)op1) < ((intptr_t)op2)) ? _VTrue : _VFalse;
+    case STRING_VALUE:
+        return (_compare_strings(AS_STRING(op1), AS_STRING(op2)) < 0) ? _VTrue : _VFalse;
     default:
-        _exception_throw(file_name, line_number,
-                         _mk_pair(
-                             _from_literal_string("InternalError"),
-                             _mk_pair(
-                                 _mk_pair(_from_literal_string("reason"), _from_literal_string("UnknownTag")),
-                                 _mk_pair(
-                                     _mk_pair(_from_literal_string("tag"), _from_literal_int(value->tag)),
-                                     _VNull))));
+        return _VFalse;
     }
 }
 
-struct Value *_from_literal_int(int v)
+struct Value *_greater_than(struct Value *op1, struct Value *op2)
+{
+    int tag = _value_tag(op1);
+
+    if (tag != _value_tag(op2))
+        return _VFalse;
+
+    switch (tag)
+    {
+    case BOOLEAN_VALUE:
+        return ((op1 == _VTrue) > (op2 == _VTrue)) ? _VTrue : _VFalse;
+    case INTEGER_VALUE:
+    case CHARACTER_VALUE:
+        return (((intptr_t)op1) > ((intptr_t)op2)) ? _VTrue : _VFalse;
+    case STRING_VALUE:
+        return (_compare_strings(AS_STRING(op1), AS_STRING(op2)) > 0) ? _VTrue : _VFalse;
+    default:
+        return _VFalse;
+    }
+}
+
+static char *_value_type_name(int tag)
+{
+    switch (tag)
+    {
+    case NULL_VALUE:
+        return "()";
+    case BOOLEAN_VALUE:
+        return "boolean";
+    case INTEGER_VALUE:
+        return "integer";
+    case STRING_VALUE:
+        return "string";
+    case PAIR_VALUE:
+        return "pair";
+    case VECTOR_VALUE:
+        return "vector";
+    case HASHMAP_VALUE:
+        return "map";
+    case SYMBOL_VALUE:
+        return "symbol";
+    case INT32_ARRAY_VALUE:
+        return "int32 array";
+    case CHARACTER_VALUE:
+        return "character";
+    case CLOSURE_VALUE:
+        return "procedure";
+    case FRAME_VALUE:
+        return "frame";
+    default:
+        return "unknown";
+    }
+}
+
+struct Value *_pair_car(char *file_name, int line_number, struct Value *pair)
+{
+    if (IS_POINTER(pair) && pair->tag == PAIR_VALUE)
+        return AS_PAIR(pair)->car;
+
+    _exception_throw(file_name, line_number,
+                     _mk_pair(
+                         _from_literal_string("EmptyList"),
+                         _mk_pair(
+                             _mk_pair(_from_literal_string("reason"), _from_literal_string("Attempt to call car on empty list")),
+                             _VNull)));
+
+    return _VNull;
+}
+
+struct Value *_pair_cdr(char *file_name, int line_number, struct Value *pair)
+{
+    if (IS_POINTER(pair) && pair->tag == PAIR_VALUE)
+        return AS_PAIR(pair)->cdr;
+
+    _exception_throw(file_name, line_number,
+                     _mk_pair(
+                         _from_literal_string("EmptyList"),
+                         _mk_pair(
+                             _mk_pair(_from_literal_string("reason"), _from_literal_string("Attempt to call cdr on empty list")),
+                             _VNull)));
+
+    return _VNull;
+}
+
+struct Value *_nullp(struct Value *v)
+{
+    return v == _VNull ? _VTrue : _VFalse;
+}
+
+struct Value *_booleanp(struct Value *v)
 {
-    struct Value *r = (struct Value *)GC_MALLOC(sizeof(struct Value));
-    r->tag = INTEGER_VALUE;
-    r->integer = v;
-    return r;
+    return IS_BOOLEAN(v) ? _VTrue : _VFalse;
 }
 
-struct Value *_from_literal_string(char *s)
+struct Value *_integerp(struct Value *v)
 {
-    struct Value *r = (struct Value *)GC_MALLOC(sizeof(struct Value));
-    r->tag = STRING_VALUE;
-    r->string = strdup(s);
-    return r;
+    return IS_INTEGER(v) ? _VTrue : _VFalse;
+}
+
+struct Value *_stringp(struct Value *v)
+{
+    return IS_POINTER(v) && v->tag == STRING_VALUE ? _VTrue : _VFalse;
 }
 
-struct Value *_wrap_native_0(void *native_procedure)
+struct Value *_pairp(struct Value *v)
 {
-    struct Value *(*f)() = native_procedure;
-    return f();
+    return IS_POINTER(v) && v->tag == PAIR_VALUE ? _VTrue : _VFalse;
 }
 
-struct Value *_wrap_native_1(void *native_procedure, struct Value *a1)
+static struct Vector *_mk_vector(int length)
 {
-    struct Value *(*f)(struct Value *) = native_procedure;
-    return f(a1);
+    struct Vector *r = (struct Vector *)_allocate(VECTOR_VALUE, sizeof(struct Vector) + sizeof(struct Value *) * length);
+    r->tag = VECTOR_VALUE;
+    r->length = length;
+
+    return r;
 }
 
-struct Value *_wrap_native_2(void *native_procedure, struct Value *a1, struct Value *a2)
+static struct Vector *_as_vector(char *file_name, int line_number, struct Value *v)
 {
-    struct Value *(*f)(struct Value *, struct Value *) = native_procedure;
-    return f(a1, a2);
+    if (!IS_POINTER(v) || v->tag != VECTOR_VALUE)
+    {
+        _exception_throw(file_name, line_number,
+                         _mk_pair(
+                             _from_literal_string("NotVector"),
+                             _mk_pair(
+                                 _mk_pair(_from_literal_string("reason"), _from_literal_string("Attempt to use value as if a vector")),
+                                 _mk_pair(
+                                     _mk_pair(_from_literal_string("tag"), _from_literal_int(_value_tag(v))),
+                                     _VNull))));
+    }
+
+    return AS_VECTOR(v);
 }
 
-struct Value *_wrap_native_3(void *native_procedure, struct Value *a1, struct Value *a2, struct Value *a3)
+/* Indices run from 0 to limit inclusive - slices may end at the vector's
+ * length.
+ */
+static int _vector_index(char *file_name, int line_number, struct Value *index, int limit)
 {
-    struct Value *(*f)(struct Value *, struct Value *, struct Value *) = native_procedure;
-    return f(a1, a2, a3);
+    if (!IS_INTEGER(index) || INTEGER_OF(index) < 0 || INTEGER_OF(index) > limit)
+    {
+        _exception_throw(file_name, line_number,
+                         _mk_pair(
+                             _from_literal_string("IndexOutOfRange"),
+                             _mk_pair(
+                                 _mk_pair(_from_literal_string("index"), index),
+                                 _mk_pair(
+                                     _mk_pair(_from_literal_string("limit"), _from_literal_int(limit)),
+                                     _VNull))));
+    }
+
+    return INTEGER_OF(index);
 }
 
-struct Value *_wrap_native_4(void *native_procedure, struct Value *a1, struct Value *a2, struct Value *a3, struct Value *a4)
+struct Value *_vector(int argc, struct Value **argv)
 {
-    struct Value *(*f)(struct Value *, struct Value *, struct Value *, struct Value *) = native_procedure;
-    return f(a1, a2, a3, a4);
+    struct Vector *r = _mk_vector(argc);
+
+    if (argc > 0)
+        memcpy(r->items, argv, sizeof(struct Value *) * argc);
+
+    return (struct Value *)r;
 }
 
-struct Value *_wrap_native_5(void *native_procedure, struct Value *a1, struct Value *a2, struct Value *a3, struct Value *a4, struct Value *a5)
+struct Value *_vectorp(struct Value *v)
 {
-    struct Value *(*f)(struct Value *, struct Value *, struct Value *, struct Value *, struct Value *) = native_procedure;
-    return f(a1, a2, a3, a4, a5);
+    return IS_POINTER(v) && v->tag == VECTOR_VALUE ? _VTrue : _VFalse;
 }
 
-struct Value *_wrap_native_6(void *native_procedure, struct Value *a1, struct Value *a2, struct Value *a3, struct Value *a4, struct Value *a5, struct Value *a6)
+struct Value *_vector_length(char *file_name, int line_number, struct Value *vector)
 {
-    struct Value *(*f)(struct Value *, struct Value *, struct Value *, struct Value *, struct Value *, struct Value *) = native_procedure;
-    return f(a1, a2, a3, a4, a5, a6);
+    return FROM_INTEGER(_as_vector(file_name, line_number, vector)->length);
 }
 
-struct Value *_wrap_native_7(void *native_procedure, struct Value *a1, struct Value *a2, struct Value *a3, struct Value *a4, struct Value *a5, struct Value *a6, struct Value *a7)
+struct Value *_vector_ref(char *file_name, int line_number, struct Value *vector, struct Value *index)
 {
-    struct Value *(*f)(struct Value *, struct Value *, struct Value *, struct Value *, struct Value *, struct Value *, struct Value *) = native_procedure;
-    return f(a1, a2, a3, a4, a5, a6, a7);
+    struct Vector *v = _as_vector(file_name, line_number, vector);
+
+    return v->items[_vector_index(file_name, line_number, index, v->length - 1)];
 }
 
-struct Value *_wrap_native_8(void *native_procedure, struct Value *a1, struct Value *a2, struct Value *a3, struct Value *a4, struct Value *a5, struct Value *a6, struct Value *a7, struct Value *a8)
+/* Vectors are immutable so setting an item returns an updated copy.
+ */
+struct Value *_vector_set(char *file_name, int line_number, struct Value *vector, struct Value *index, struct Value *value)
 {
-    struct Value *(*f)(struct Value *, struct Value *, struct Value *, struct Value *, struct Value *, struct Value *, struct Value *, struct Value *) = native_procedure;
-    return f(a1, a2, a3, a4, a5, a6, a7, a8);
+    struct Vector *v = _as_vector(file_name, line_number, vector);
+    int i = _vector_index(file_name, line_number, index, v->length - 1);
+    struct Vector *r = _mk_vector(v->length);
+
+    memcpy(r->items, v->items, sizeof(struct Value *) * v->length);
+    r->items[i] = value;
+
+    return (struct Value *)r;
 }
 
-struct Value *_wrap_native_9(void *native_procedure, struct Value *a1, struct Value *a2, struct Value *a3, struct Value *a4, struct Value *a5, struct Value *a6, struct Value *a7, struct Value *a8, struct Value *a9)
+struct Value *_vector_slice(char *file_name, int line_number, struct Value *vector, struct Value *start, struct Value *end)
 {
-    struct Value *(*f)(struct Value *, struct Value *, struct Value *, struct Value *, struct Value *, struct Value *, struct Value *, struct Value *, struct Value *) = native_procedure;
-    return f(a1, a2, a3, a4, a5, a6, a7, a8, a9);
+    struct Vector *v = _as_vector(file_name, line_number, vector);
+    int s = _vector_index(file_name, line_number, start, v->length);
+    int e = _vector_index(file_name, line_number, end, v->length);
+
+    if (e < s)
+        e = s;
+
+    struct Vector *r = _mk_vector(e - s);
+    memcpy(r->items, v->items + s, sizeof(struct Value *) * (e - s));
+
+    return (struct Value *)r;
 }
 
-struct Value *_wrap_native_10(void *native_procedure, struct Value *a1, struct Value *a2, struct Value *a3, struct Value *a4, struct Value *a5, struct Value *a6, struct Value *a7, struct Value *a8, struct Value *a9, struct Value *a10)
+struct Value *_vector_to_list(char *file_name, int line_number, struct Value *vector)
 {
-    struct Value *(*f)(struct Value *, struct Value *, struct Value *, struct Value *, struct Value *, struct Value *, struct Value *, struct Value *, struct Value *, struct Value *) = native_procedure;
-    return f(a1, a2, a3, a4, a5, a6, a7, a8, a9, a10);
+    struct Vector *v = _as_vector(file_name, line_number, vector);
+    struct Value *result = _VNull;
+
+    for (int i = v->length - 1; i >= 0; i -= 1)
+        result = _mk_pair(v->items[i], result);
+
+    return result;
 }
 
-struct Value *_from_native_var_arg_procedure(void *procedure)
+/* An improper list's final cdr is ignored.
+ */
+struct Value *_list_to_vector(char *file_name, int line_number, struct Value *list)
 {
-    struct Value *r = (struct Value *)GC_MALLOC(sizeof(struct Value));
-    r->tag = NATIVE_VAR_ARG_CLOSURE_VALUE;
-    r->native_var_arg_closure.native_procedure = procedure;
+    int length = 0;
 
-    return r;
+    for (struct Value *runner = list; IS_POINTER(runner) && runner->tag == PAIR_VALUE; runner = AS_PAIR(runner)->cdr)
+        length += 1;
+
+    struct Vector *r = _mk_vector(length);
+    struct Value *runner = list;
+
+    for (int i = 0; i < length; i += 1)
+    {
+        r->items[i] = AS_PAIR(runner)->car;
+        runner = AS_PAIR(runner)->cdr;
+    }
+
+    return (struct Value *)r;
 }
 
-struct Value *_from_native_var_arg_position_procedure(char *file_name, int line_number, void *procedure)
+/* Int32 arrays hold unboxed 32-bit integers so that the kernels below can
+ * work on them with SIMD instructions.  Arithmetic wraps, as _plus and
+ * friends do.  On x86-64 each kernel has an AVX2 version, selected when the
+ * CPU supports it, falling back to SSE2, which every x86-64 CPU has, or to a
+ * scalar loop.
+ */
+#if defined(__x86_64__)
+#include <immintrin.h>
+#define INT32_KERNELS_X86 1
+#define HAS_AVX2() __builtin_cpu_supports("avx2")
+#endif
+
+static struct Int32Array *_mk_int32_array(int length)
 {
-    struct Value *r = (struct Value *)GC_MALLOC(sizeof(struct Value));
-    r->tag = NATIVE_VAR_ARG_CLOSURE_POSITION_VALUE;
-    r->native_var_arg_closure_position.native_procedure = procedure;
-    r->native_var_arg_closure_position.file_name = file_name;
-    r->native_var_arg_closure_position.line_number = line_number;
+    struct Int32Array *r = (struct Int32Array *)_allocate_atomic(INT32_ARRAY_VALUE, sizeof(struct Int32Array) + sizeof(int32_t) * length);
+    r->tag = INT32_ARRAY_VALUE;
+    r->length = length;
 
     return r;
 }
 
-struct Value *_from_native_procedure(char *file_name, int line_number, void *procedure, int number_arguments)
+static struct Int32Array *_as_int32_array(char *file_name, int line_number, struct Value *v)
 {
-    struct Value *r = (struct Value *)GC_MALLOC(sizeof(struct Value));
-    r->tag = NATIVE_CLOSURE_VALUE;
-
-    switch (number_arguments)
+    if (!IS_POINTER(v) || v->tag != INT32_ARRAY_VALUE)
     {
-    case 0:
-        r->native_closure.procedure = &_wrap_native_0;
-        break;
-    case 1:
-        r->native_closure.procedure = &_wrap_native_1;
-        break;
-    case 2:
-        r->native_closure.procedure = &_wrap_native_2;
-        break;
-    case 3:
-        r->native_closure.procedure = &_wrap_native_3;
-        break;
-    case 4:
-        r->native_closure.procedure = &_wrap_native_4;
-        break;
-    case 5:
-        r->native_closure.procedure = &_wrap_native_5;
-        break;
-    case 6:
-        r->native_closure.procedure = &_wrap_native_6;
-        break;
-    case 7:
-        r->native_closure.procedure = &_wrap_native_7;
-        break;
-    case 8:
-        r->native_closure.procedure = &_wrap_native_8;
-        break;
-    case 9:
-        r->native_closure.procedure = &_wrap_native_9;
-        break;
-    case 10:
-        r->native_closure.procedure = &_wrap_native_10;
-        break;
-    default:
         _exception_throw(file_name, line_number,
                          _mk_pair(
-                             _from_literal_string("InternalError"),
+                             _from_literal_string("NotInt32Array"),
                              _mk_pair(
-                                 _mk_pair(_from_literal_string("reason"), _from_literal_string("UnableToWrapNative")),
+                                 _mk_pair(_from_literal_string("reason"), _from_literal_string("Attempt to use value as if an int32 array")),
                                  _mk_pair(
-                                     _mk_pair(_from_literal_string("number-of-arguments"), _from_literal_int(number_arguments)),
+                                     _mk_pair(_from_literal_string("tag"), _from_literal_int(_value_tag(v))),
                                      _VNull))));
     }
 
-    r->native_closure.number_arguments = number_arguments;
-    r->native_closure.native_procedure = procedure;
-
-    return r;
+    return AS_INT32_ARRAY(v);
 }
 
-struct Value *_from_dynamic_procedure(void *procedure, int number_arguments, struct Value *frame)
+static int32_t _int32_of(char *file_name, int line_number, struct Value *v)
 {
-    struct Value *r = (struct Value *)GC_MALLOC(sizeof(struct Value));
-    r->tag = DYNAMIC_CLOSURE_VALUE;
-    r->dynamic_closure.procedure = procedure;
-    r->dynamic_closure.number_arguments = number_arguments;
-    r->dynamic_closure.frame = frame;
+    if (!IS_INTEGER(v))
+    {
+        _exception_throw(file_name, line_number,
+                         _mk_pair(
+                             _from_literal_string("NotInteger"),
+                             _mk_pair(
+                                 _mk_pair(_from_literal_string("value"), v),
+                                 _VNull)));
+    }
 
-    return r;
+    return INTEGER_OF(v);
 }
 
-void _assert_callable_closure(char *file_name, int line_number, struct Value *closure, int number_arguments)
+static void _assert_same_length(char *file_name, int line_number, struct Int32Array *a1, struct Int32Array *a2)
 {
-    if (closure->tag != NATIVE_CLOSURE_VALUE && closure->tag != DYNAMIC_CLOSURE_VALUE)
+    if (a1->length != a2->length)
     {
         _exception_throw(file_name, line_number,
                          _mk_pair(
-                             _from_literal_string("NotClosure"),
+                             _from_literal_string("LengthMismatch"),
                              _mk_pair(
-                                 _mk_pair(_from_literal_string("reason"), _from_literal_string("Attempt to call value as if a closure")),
+                                 _mk_pair(_from_literal_string("length1"), _from_literal_int(a1->length)),
                                  _mk_pair(
-                                     _mk_pair(_from_literal_string("tag"), _from_literal_int(closure->tag)),
+                                     _mk_pair(_from_literal_string("length2"), _from_literal_int(a2->length)),
                                      _VNull))));
     }
-    if (closure->native_closure.number_arguments != number_arguments)
+}
+
+static void _assert_not_empty(char *file_name, int line_number, struct Int32Array *a)
+{
+    if (a->length == 0)
     {
         _exception_throw(file_name, line_number,
                          _mk_pair(
-                             _from_literal_string("ArgumentCountMismatch"),
+                             _from_literal_string("EmptyInt32Array"),
                              _mk_pair(
-                                 _mk_pair(_from_literal_string("reason"), _from_literal_string("Argument mismatch")),
-                                 _mk_pair(
-                                     _mk_pair(_from_literal_string("received"), _from_literal_int(number_arguments)),
-                                     _mk_pair(
-                                         _mk_pair(_from_literal_string("expected"), _from_literal_int(closure->native_closure.number_arguments)),
-                                         _VNull)))));
+                                 _mk_pair(_from_literal_string("reason"), _from_literal_string("Attempt to reduce an empty int32 array")),
+                                 _VNull)));
     }
 }
 
-struct Value *_mk_frame(struct Value *parent, int size)
+#ifdef INT32_KERNELS_X86
+static int32_t _horizontal_add_sse2(__m128i v)
 {
-    struct Value *frame = (struct Value *)GC_MALLOC(sizeof(struct Value));
-    frame->tag = VECTOR_VALUE;
-    frame->vector.length = 1;
-    frame->vector.items = (struct Value **)GC_MALLOC(sizeof(struct Value *) * (1 + size));
-    frame->vector.items[0] = parent;
+    v = _mm_add_epi32(v, _mm_shuffle_epi32(v, _MM_SHUFFLE(1, 0, 3, 2)));
+    v = _mm_add_epi32(v, _mm_shuffle_epi32(v, _MM_SHUFFLE(2, 3, 0, 1)));
 
-    while (size > 0)
-    {
-        frame->vector.items[size] = _VNull;
-        size -= 1;
-    }
+    return _mm_cvtsi128_si32(v);
+}
 
-    return frame;
+__attribute__((target("avx2"))) static int32_t _int32_sum_avx2(int32_t *items, int length)
+{
+    __m256i acc = _mm256_setzero_si256();
+    int i = 0;
+
+    for (; i + 8 <= length; i += 8)
+        acc = _mm256_add_epi32(acc, _mm256_loadu_si256((__m256i *)(items + i)));
+
+    uint32_t r = _horizontal_add_sse2(_mm_add_epi32(_mm256_castsi256_si128(acc), _mm256_extracti128_si256(acc, 1)));
+    for (; i < length; i += 1)
+        r += (uint32_t)items[i];
+
+    return (int32_t)r;
 }
 
-struct Value *_get_frame(struct Value *frame, int depth)
+static int32_t _int32_sum_sse2(int32_t *items, int length)
 {
-    while (depth > 0)
-    {
-        frame = frame->vector.items[0];
-        depth -= 1;
-    }
-    return frame;
+    __m128i acc = _mm_setzero_si128();
+    int i = 0;
+
+    for (; i + 4 <= length; i += 4)
+        acc = _mm_add_epi32(acc, _mm_loadu_si128((__m128i *)(items + i)));
+
+    uint32_t r = _horizontal_add_sse2(acc);
+    for (; i < length; i += 1)
+        r += (uint32_t)items[i];
+
+    return (int32_t)r;
 }
 
-struct Value *_get_frame_value(struct Value *frame, int depth, int offset)
+__attribute__((target("avx2"))) static int32_t _int32_dot_avx2(int32_t *items1, int32_t *items2, int length)
 {
-    return _get_frame(frame, depth)->vector.items[offset];
+    __m256i acc = _mm256_setzero_si256();
+    int i = 0;
+
+    for (; i + 8 <= length; i += 8)
+        acc = _mm256_add_epi32(acc, _mm256_mullo_epi32(_mm256_loadu_si256((__m256i *)(items1 + i)), _mm256_loadu_si256((__m256i *)(items2 + i))));
+
+    uint32_t r = _horizontal_add_sse2(_mm_add_epi32(_mm256_castsi256_si128(acc), _mm256_extracti128_si256(acc, 1)));
+    for (; i < length; i += 1)
+        r += (uint32_t)items1[i] * (uint32_t)items2[i];
+
+    return (int32_t)r;
 }
 
-void _set_frame_value(struct Value *frame, int depth, int offset, struct Value *value)
+__attribute__((target("avx2"))) static int32_t _int32_min_avx2(int32_t *items, int length)
 {
-    while (depth > 0)
-    {
-        frame = frame->vector.items[0];
-        depth -= 1;
-    }
-    frame->vector.items[offset] = value;
+    __m256i acc = _mm256_set1_epi32(items[0]);
+    int i = 0;
+
+    for (; i + 8 <= length; i += 8)
+        acc = _mm256_min_epi32(acc, _mm256_loadu_si256((__m256i *)(items + i)));
+
+    int32_t lanes[8];
+    _mm256_storeu_si256((__m256i *)lanes, acc);
+
+    int32_t r = lanes[0];
+    for (int j = 1; j < 8; j += 1)
+        r = lanes[j] < r ? lanes[j] : r;
+    for (; i < length; i += 1)
+        r = items[i] < r ? items[i] : r;
+
+    return r;
 }
 
-struct Value *_call_closure_0(char *file_name, int line_number, struct Value *closure)
+__attribute__((target("avx2"))) static int32_t _int32_max_avx2(int32_t *items, int length)
 {
-    if (closure->tag == NATIVE_VAR_ARG_CLOSURE_VALUE)
-    {
-        struct Value *(*f)(int, ...) = closure->native_var_arg_closure.native_procedure;
-        return f(0);
-    }
-    else if (closure->tag == NATIVE_VAR_ARG_CLOSURE_POSITION_VALUE)
-    {
-        struct Value *(*f)(char *, int, int, ...) = closure->native_var_arg_closure_position.native_procedure;
-        return f(closure->native_var_arg_closure_position.file_name, closure->native_var_arg_closure_position.line_number, 0);
-    }
-    else
-    {
-        _assert_callable_closure(file_name, line_number, closure, 0);
+    __m256i acc = _mm256_set1_epi32(items[0]);
+    int i = 0;
 
-        struct Value *(*f)(struct Value *) = closure->dynamic_closure.procedure;
+    for (; i + 8 <= length; i += 8)
+        acc = _mm256_max_epi32(acc, _mm256_loadu_si256((__m256i *)(items + i)));
 
-        return f(closure->dynamic_closure.frame);
-    }
+    int32_t lanes[8];
+    _mm256_storeu_si256((__m256i *)lanes, acc);
+
+    int32_t r = lanes[0];
+    for (int j = 1; j < 8; j += 1)
+        r = lanes[j] > r ? lanes[j] : r;
+    for (; i < length; i += 1)
+        r = items[i] > r ? items[i] : r;
+
+    return r;
 }
 
-struct Value *_call_closure_1(char *file_name, int line_number, struct Value *closure, struct Value *a1)
+__attribute__((target("avx2"))) static void _int32_add_avx2(int32_t *result, int32_t *items1, int32_t *items2, int length)
 {
-    if (closure->tag == NATIVE_VAR_ARG_CLOSURE_VALUE)
-    {
-        struct Value *(*f)(int, ...) = closure->native_var_arg_closure.native_procedure;
-        return f(1, a1);
-    }
-    else if (closure->tag == NATIVE_VAR_ARG_CLOSURE_POSITION_VALUE)
-    {
-        struct Value *(*f)(char *, int, int, ...) = closure->native_var_arg_closure_position.native_procedure;
-        return f(closure->native_var_arg_closure_position.file_name, closure->native_var_arg_closure_position.line_number, 1, a1);
-    }
-    else
-    {
-        _assert_callable_closure(file_name, line_number, closure, 1);
+    int i = 0;
 
-        struct Value *(*f)(struct Value *, struct Value *) = closure->dynamic_closure.procedure;
+    for (; i + 8 <= length; i += 8)
+        _mm256_storeu_si256((__m256i *)(result + i), _mm256_add_epi32(_mm256_loadu_si256((__m256i *)(items1 + i)), _mm256_loadu_si256((__m256i *)(items2 + i))));
+    for (; i < length; i += 1)
+        result[i] = (int32_t)((uint32_t)items1[i] + (uint32_t)items2[i]);
+}
 
-        return f(closure->dynamic_closure.frame, a1);
-    }
+static void _int32_add_sse2(int32_t *result, int32_t *items1, int32_t *items2, int length)
+{
+    int i = 0;
+
+    for (; i + 4 <= length; i += 4)
+        _mm_storeu_si128((__m128i *)(result + i), _mm_add_epi32(_mm_loadu_si128((__m128i *)(items1 + i)), _mm_loadu_si128((__m128i *)(items2 + i))));
+    for (; i < length; i += 1)
+        result[i] = (int32_t)((uint32_t)items1[i] + (uint32_t)items2[i]);
 }
 
-struct Value *_call_closure_2(char *file_name, int line_number, struct Value *closure, struct Value *a1, struct Value *a2)
+__attribute__((target("avx2"))) static void _int32_multiply_avx2(int32_t *result, int32_t *items1, int32_t *items2, int length)
 {
-    if (closure->tag == NATIVE_VAR_ARG_CLOSURE_VALUE)
+    int i = 0;
+
+    for (; i + 8 <= length; i += 8)
+        _mm256_storeu_si256((__m256i *)(result + i), _mm256_mullo_epi32(_mm256_loadu_si256((__m256i *)(items1 + i)), _mm256_loadu_si256((__m256i *)(items2 + i))));
+    for (; i < length; i += 1)
+        result[i] = (int32_t)((uint32_t)items1[i] * (uint32_t)items2[i]);
+}
+
+/* Each block of four is scanned in register with two shifted adds and then
+ * offset by the running total of the blocks before it.
+ */
+static void _int32_prefix_sum_sse2(int32_t *result, int32_t *items, int length)
+{
+    __m128i carry = _mm_setzero_si128();
+    int i = 0;
+
+    for (; i + 4 <= length; i += 4)
     {
-        struct Value *(*f)(int, ...) = closure->native_var_arg_closure.native_procedure;
-        return f(2, a1, a2);
+        __m128i x = _mm_loadu_si128((__m128i *)(items + i));
+        x = _mm_add_epi32(x, _mm_slli_si128(x, 4));
+        x = _mm_add_epi32(x, _mm_slli_si128(x, 8));
+        x = _mm_add_epi32(x, carry);
+        _mm_storeu_si128((__m128i *)(result + i), x);
+        carry = _mm_shuffle_epi32(x, _MM_SHUFFLE(3, 3, 3, 3));
     }
-    else if (closure->tag == NATIVE_VAR_ARG_CLOSURE_POSITION_VALUE)
+
+    uint32_t total = (uint32_t)_mm_cvtsi128_si32(carry);
+    for (; i < length; i += 1)
     {
-        struct Value *(*f)(char *, int, int, ...) = closure->native_var_arg_closure_position.native_procedure;
-        return f(closure->native_var_arg_closure_position.file_name, closure->native_var_arg_closure_position.line_number, 2, a1, a2);
+        total += (uint32_t)items[i];
+        result[i] = (int32_t)total;
     }
-    else
-    {
-        _assert_callable_closure(file_name, line_number, closure, 2);
+}
+#endif
 
-        struct Value *(*f)(struct Value *, struct Value *, struct Value *) = closure->dynamic_closure.procedure;
+static int32_t _int32_sum(int32_t *items, int length)
+{
+#ifdef INT32_KERNELS_X86
+    return HAS_AVX2() ? _int32_sum_avx2(items, length) : _int32_sum_sse2(items, length);
+#else
+    uint32_t r = 0;
+    for (int i = 0; i < length; i += 1)
+        r += (uint32_t)items[i];
+
+    return (int32_t)r;
+#endif
+}
 
-        return f(closure->dynamic_closure.frame, a1, a2);
-    }
+static int32_t _int32_dot(int32_t *items1, int32_t *items2, int length)
+{
+#ifdef INT32_KERNELS_X86
+    if (HAS_AVX2())
+        return _int32_dot_avx2(items1, items2, length);
+#endif
+    uint32_t r = 0;
+    for (int i = 0; i < length; i += 1)
+        r += (uint32_t)items1[i] * (uint32_t)items2[i];
+
+    return (int32_t)r;
 }
 
-struct Value *_call_closure_3(char *file_name, int line_number, struct Value *closure, struct Value *a1, struct Value *a2, struct Value *a3)
+static int32_t _int32_min(int32_t *items, int length)
 {
-    if (closure->tag == NATIVE_VAR_ARG_CLOSURE_VALUE)
-    {
-        struct Value *(*f)(int, ...) = closure->native_var_arg_closure.native_procedure;
-        return f(3, a1, a2, a3);
-    }
-    else if (closure->tag == NATIVE_VAR_ARG_CLOSURE_POSITION_VALUE)
-    {
-        struct Value *(*f)(char *, int, int, ...) = closure->native_var_arg_closure_position.native_procedure;
-        return f(closure->native_var_arg_closure_position.file_name, closure->native_var_arg_closure_position.line_number, 3, a1, a2, a3);
-    }
-    else
-    {
-        _assert_callable_closure(file_name, line_number, closure, 3);
+#ifdef INT32_KERNELS_X86
+    if (HAS_AVX2())
+        return _int32_min_avx2(items, length);
+#endif
+    int32_t r = items[0];
+    for (int i = 1; i < length; i += 1)
+        r = items[i] < r ? items[i] : r;
 
-        struct Value *(*f)(struct Value *, struct Value *, struct Value *, struct Value *) = closure->dynamic_closure.procedure;
+    return r;
+}
 
-        return f(closure->dynamic_closure.frame, a1, a2, a3);
-    }
+static int32_t _int32_max(int32_t *items, int length)
+{
+#ifdef INT32_KERNELS_X86
+    if (HAS_AVX2())
+        return _int32_max_avx2(items, length);
+#endif
+    int32_t r = items[0];
+    for (int i = 1; i < length; i += 1)
+        r = items[i] > r ? items[i] : r;
+
+    return r;
+}
+
+static void _int32_add(int32_t *result, int32_t *items1, int32_t *items2, int length)
+{
+#ifdef INT32_KERNELS_X86
+    if (HAS_AVX2())
+        _int32_add_avx2(result, items1, items2, length);
+    else
+        _int32_add_sse2(result, items1, items2, length);
+#else
+    for (int i = 0; i < length; i += 1)
+        result[i] = (int32_t)((uint32_t)items1[i] + (uint32_t)items2[i]);
+#endif
 }
 
-struct Value *_call_closure_4(char *file_name, int line_number, struct Value *closure, struct Value *a1, struct Value *a2, struct Value *a3, struct Value *a4)
+static void _int32_multiply(int32_t *result, int32_t *items1, int32_t *items2, int length)
 {
-    if (closure->tag == NATIVE_VAR_ARG_CLOSURE_VALUE)
+#ifdef INT32_KERNELS_X86
+    if (HAS_AVX2())
     {
-        struct Value *(*f)(int, ...) = closure->native_var_arg_closure.native_procedure;
-        return f(4, a1, a2, a3, a4);
+        _int32_multiply_avx2(result, items1, items2, length);
+        return;
     }
-    else if (closure->tag == NATIVE_VAR_ARG_CLOSURE_POSITION_VALUE)
+#endif
+    for (int i = 0; i < length; i += 1)
+        result[i] = (int32_t)((uint32_t)items1[i] * (uint32_t)items2[i]);
+}
+
+static void _int32_prefix_sum(int32_t *result, int32_t *items, int length)
+{
+#ifdef INT32_KERNELS_X86
+    _int32_prefix_sum_sse2(result, items, length);
+#else
+    uint32_t total = 0;
+    for (int i = 0; i < length; i += 1)
     {
-        struct Value *(*f)(char *, int, int, ...) = closure->native_var_arg_closure_position.native_procedure;
-        return f(closure->native_var_arg_closure_position.file_name, closure->native_var_arg_closure_position.line_number, 4, a1, a2, a3, a4);
+        total += (uint32_t)items[i];
+        result[i] = (int32_t)total;
     }
-    else
-    {
-        _assert_callable_closure(file_name, line_number, closure, 4);
+#endif
+}
 
-        struct Value *(*f)(struct Value *, struct Value *, struct Value *, struct Value *, struct Value *) = closure->dynamic_closure.procedure;
+struct Value *_int32_array(char *file_name, int line_number, int argc, struct Value **argv)
+{
+    struct Int32Array *r = _mk_int32_array(argc);
 
-        return f(closure->dynamic_closure.frame, a1, a2, a3, a4);
-    }
+    for (int i = 0; i < argc; i += 1)
+        r->items[i] = _int32_of(file_name, line_number, argv[i]);
+
+    return (struct Value *)r;
 }
 
-struct Value *_call_closure_5(char *file_name, int line_number, struct Value *closure, struct Value *a1, struct Value *a2, struct Value *a3, struct Value *a4, struct Value *a5)
+struct Value *_int32_arrayp(struct Value *v)
 {
-    if (closure->tag == NATIVE_VAR_ARG_CLOSURE_VALUE)
-    {
-        struct Value *(*f)(int, ...) = closure->native_var_arg_closure.native_procedure;
-        return f(5, a1, a2, a3, a4, a5);
-    }
-    else if (closure->tag == NATIVE_VAR_ARG_CLOSURE_POSITION_VALUE)
+    return IS_POINTER(v) && v->tag == INT32_ARRAY_VALUE ? _VTrue : _VFalse;
+}
+
+/* The integers from start up to but not including end.
+ */
+struct Value *_int32_array_range(char *file_name, int line_number, struct Value *start, struct Value *end)
+{
+    int32_t s = _int32_of(file_name, line_number, start);
+    int32_t e = _int32_of(file_name, line_number, end);
+    int64_t span = (int64_t)e - (int64_t)s;
+
+    if (span > INT32_MAX)
     {
-        struct Value *(*f)(char *, int, int, ...) = closure->native_var_arg_closure_position.native_procedure;
-        return f(closure->native_var_arg_closure_position.file_name, closure->native_var_arg_closure_position.line_number, 5, a1, a2, a3, a4, a5);
+        _exception_throw(file_name, line_number,
+                         _mk_pair(
+                             _from_literal_string("LengthOutOfRange"),
+                             _mk_pair(
+                                 _mk_pair(_from_literal_string("start"), start),
+                                 _mk_pair(
+                                     _mk_pair(_from_literal_string("end"), end),
+                                     _VNull))));
     }
-    else
-    {
-        _assert_callable_closure(file_name, line_number, closure, 5);
 
-        struct Value *(*f)(struct Value *, struct Value *, struct Value *, struct Value *, struct Value *, struct Value *) = closure->dynamic_closure.procedure;
+    struct Int32Array *r = _mk_int32_array(span > 0 ? (int)span : 0);
 
-        return f(closure->dynamic_closure.frame, a1, a2, a3, a4, a5);
-    }
+    for (int i = 0; i < r->length; i += 1)
+        r->items[i] = s + i;
+
+    return (struct Value *)r;
 }
 
-struct Value *_call_closure_6(char *file_name, int line_number, struct Value *closure, struct Value *a1, struct Value *a2, struct Value *a3, struct Value *a4, struct Value *a5, struct Value *a6)
+struct Value *_int32_array_length(char *file_name, int line_number, struct Value *array)
 {
-    if (closure->tag == NATIVE_VAR_ARG_CLOSURE_VALUE)
-    {
-        struct Value *(*f)(int, ...) = closure->native_var_arg_closure.native_procedure;
-        return f(6, a1, a2, a3, a4, a5, a6);
-    }
-    else if (closure->tag == NATIVE_VAR_ARG_CLOSURE_POSITION_VALUE)
-    {
-        struct Value *(*f)(char *, int, int, ...) = closure->native_var_arg_closure_position.native_procedure;
-        return f(closure->native_var_arg_closure_position.file_name, closure->native_var_arg_closure_position.line_number, 6, a1, a2, a3, a4, a5, a6);
-    }
-    else
-    {
-        _assert_callable_closure(file_name, line_number, closure, 6);
+    return FROM_INTEGER(_as_int32_array(file_name, line_number, array)->length);
+}
 
-        struct Value *(*f)(struct Value *, struct Value *, struct Value *, struct Value *, struct Value *, struct Value *, struct Value *) = closure->dynamic_closure.procedure;
+struct Value *_int32_array_ref(char *file_name, int line_number, struct Value *array, struct Value *index)
+{
+    struct Int32Array *a = _as_int32_array(file_name, line_number, array);
 
-        return f(closure->dynamic_closure.frame, a1, a2, a3, a4, a5, a6);
-    }
+    return FROM_INTEGER(a->items[_vector_index(file_name, line_number, index, a->length - 1)]);
 }
 
-struct Value *_call_closure_7(char *file_name, int line_number, struct Value *closure, struct Value *a1, struct Value *a2, struct Value *a3, struct Value *a4, struct Value *a5, struct Value *a6, struct Value *a7)
+struct Value *_vector_to_int32_array(char *file_name, int line_number, struct Value *vector)
 {
-    if (closure->tag == NATIVE_VAR_ARG_CLOSURE_VALUE)
-    {
-        struct Value *(*f)(int, ...) = closure->native_var_arg_closure.native_procedure;
-        return f(7, a1, a2, a3, a4, a5, a6, a7);
-    }
-    else if (closure->tag == NATIVE_VAR_ARG_CLOSURE_POSITION_VALUE)
-    {
-        struct Value *(*f)(char *, int, int, ...) = closure->native_var_arg_closure_position.native_procedure;
-        return f(closure->native_var_arg_closure_position.file_name, closure->native_var_arg_closure_position.line_number, 7, a1, a2, a3, a4, a5, a6, a7);
-    }
-    else
-    {
-        _assert_callable_closure(file_name, line_number, closure, 7);
+    struct Vector *v = _as_vector(file_name, line_number, vector);
 
-        struct Value *(*f)(struct Value *, struct Value *, struct Value *, struct Value *, struct Value *, struct Value *, struct Value *, struct Value *) = closure->dynamic_closure.procedure;
+    return _int32_array(file_name, line_number, v->length, v->items);
+}
 
-        return f(closure->dynamic_closure.frame, a1, a2, a3, a4, a5, a6, a7);
-    }
+struct Value *_int32_array_to_vector(char *file_name, int line_number, struct Value *array)
+{
+    struct Int32Array *a = _as_int32_array(file_name, line_number, array);
+    struct Vector *r = _mk_vector(a->length);
+
+    for (int i = 0; i < a->length; i += 1)
+        r->items[i] = FROM_INTEGER(a->items[i]);
+
+    return (struct Value *)r;
 }
 
-struct Value *_call_closure_8(char *file_name, int line_number, struct Value *closure, struct Value *a1, struct Value *a2, struct Value *a3, struct Value *a4, struct Value *a5, struct Value *a6, struct Value *a7, struct Value *a8)
+struct Value *_int32_array_sum(char *file_name, int line_number, struct Value *array)
 {
-    if (closure->tag == NATIVE_VAR_ARG_CLOSURE_VALUE)
-    {
-        struct Value *(*f)(int, ...) = closure->native_var_arg_closure.native_procedure;
-        return f(8, a1, a2, a3, a4, a5, a6, a7, a8);
-    }
-    else if (closure->tag == NATIVE_VAR_ARG_CLOSURE_POSITION_VALUE)
-    {
-        struct Value *(*f)(char *, int, int, ...) = closure->native_var_arg_closure_position.native_procedure;
-        return f(closure->native_var_arg_closure_position.file_name, closure->native_var_arg_closure_position.line_number, 8, a1, a2, a3, a4, a5, a6, a7, a8);
-    }
-    else
+    struct Int32Array *a = _as_int32_array(file_name, line_number, array);
+
+    return FROM_INTEGER(_int32_sum(a->items, a->length));
+}
+
+struct Value *_int32_array_min(char *file_name, int line_number, struct Value *array)
+{
+    struct Int32Array *a = _as_int32_array(file_name, line_number, array);
+    _assert_not_empty(file_name, line_number, a);
+
+    return FROM_INTEGER(_int32_min(a->items, a->length));
+}
+
+struct Value *_int32_array_max(char *file_name, int line_number, struct Value *array)
+{
+    struct Int32Array *a = _as_int32_array(file_name, line_number, array);
+    _assert_not_empty(file_name, line_number, a);
+
+    return FROM_INTEGER(_int32_max(a->items, a->length));
+}
+
+struct Value *_int32_array_dot(char *file_name, int line_number, struct Value *array1, struct Value *array2)
+{
+    struct Int32Array *a1 = _as_int32_array(file_name, line_number, array1);
+    struct Int32Array *a2 = _as_int32_array(file_name, line_number, array2);
+    _assert_same_length(file_name, line_number, a1, a2);
+
+    return FROM_INTEGER(_int32_dot(a1->items, a2->items, a1->length));
+}
+
+struct Value *_int32_array_add(char *file_name, int line_number, struct Value *array1, struct Value *array2)
+{
+    struct Int32Array *a1 = _as_int32_array(file_name, line_number, array1);
+    struct Int32Array *a2 = _as_int32_array(file_name, line_number, array2);
+    _assert_same_length(file_name, line_number, a1, a2);
+
+    struct Int32Array *r = _mk_int32_array(a1->length);
+    _int32_add(r->items, a1->items, a2->items, a1->length);
+
+    return (struct Value *)r;
+}
+
+struct Value *_int32_array_multiply(char *file_name, int line_number, struct Value *array1, struct Value *array2)
+{
+    struct Int32Array *a1 = _as_int32_array(file_name, line_number, array1);
+    struct Int32Array *a2 = _as_int32_array(file_name, line_number, array2);
+    _assert_same_length(file_name, line_number, a1, a2);
+
+    struct Int32Array *r = _mk_int32_array(a1->length);
+    _int32_multiply(r->items, a1->items, a2->items, a1->length);
+
+    return (struct Value *)r;
+}
+
+struct Value *_int32_array_prefix_sum(char *file_name, int line_number, struct Value *array)
+{
+    struct Int32Array *a = _as_int32_array(file_name, line_number, array);
+    struct Int32Array *r = _mk_int32_array(a->length);
+
+    _int32_prefix_sum(r->items, a->items, a->length);
+
+    return (struct Value *)r;
+}
+
+static int _hashmap_capacity(int size)
+{
+    int capacity = 4;
+
+    while (capacity < 2 * size + 1)
+        capacity *= 2;
+
+    return capacity;
+}
+
+static struct HashMap *_mk_hashmap_version(int size, int used, struct HashMapTable *table)
+{
+    struct HashMap *r = (struct HashMap *)_allocate(HASHMAP_VALUE, sizeof(struct HashMap));
+    r->tag = HASHMAP_VALUE;
+    r->size = size;
+    r->used = used;
+    r->slot = 0;
+    r->table = table;
+    r->next = NULL;
+    r->entry = (struct HashMapEntry){NULL, NULL, 0};
+
+    return r;
+}
+
+/* An empty map with a table of room for size entries.
+ */
+static struct HashMap *_mk_hashmap(int size)
+{
+    int capacity = _hashmap_capacity(size);
+    struct HashMapTable *table = (struct HashMapTable *)_allocate(HASHMAP_VALUE, sizeof(struct HashMapTable) + sizeof(struct HashMapEntry) * capacity);
+    table->capacity = capacity;
+    memset(table->entries, 0, sizeof(struct HashMapEntry) * capacity);
+
+    return _mk_hashmap_version(0, 0, table);
+}
+
+/* Only used while a map is being built, before anything else can see it,
+ * and so only on a table with room for the key.
+ */
+static void _hashmap_insert(struct HashMap *map, struct Value *key, struct Value *value, uintptr_t hash)
+{
+    struct HashMapEntry *entry = _hashmap_find(map->table->entries, map->table->capacity, key, hash);
+
+    if (entry == NULL)
     {
-        _assert_callable_closure(file_name, line_number, closure, 8);
+        uintptr_t mask = map->table->capacity - 1;
+        uintptr_t i = hash & mask;
 
-        struct Value *(*f)(struct Value *, struct Value *, struct Value *, struct Value *, struct Value *, struct Value *, struct Value *, struct Value *, struct Value *) = closure->dynamic_closure.procedure;
+        while (map->table->entries[i].key != NULL)
+            i = (i + 1) & mask;
 
-        return f(closure->dynamic_closure.frame, a1, a2, a3, a4, a5, a6, a7, a8);
+        entry = map->table->entries + i;
+        entry->key = key;
+        entry->hash = hash;
+        map->size += 1;
+        map->used += 1;
     }
+    entry->value = value;
 }
 
-struct Value *_call_closure_9(char *file_name, int line_number, struct Value *closure, struct Value *a1, struct Value *a2, struct Value *a3, struct Value *a4, struct Value *a5, struct Value *a6, struct Value *a7, struct Value *a8, struct Value *a9)
+/* Makes map the version that reads its table.  The chain from map to the
+ * current version is first reversed and then walked back towards map, each
+ * step swapping a version's recorded entry with the table's so that the
+ * version it leaves behind records what the table held.
+ */
+static struct HashMapTable *_hashmap_reroot(struct HashMap *map)
 {
-    if (closure->tag == NATIVE_VAR_ARG_CLOSURE_VALUE)
+    if (map->table != NULL)
+        return map->table;
+
+    struct HashMap *previous = NULL;
+    struct HashMap *current = map;
+
+    while (current->table == NULL)
     {
-        struct Value *(*f)(int, ...) = closure->native_var_arg_closure.native_procedure;
-        return f(9, a1, a2, a3, a4, a5, a6, a7, a8, a9);
+        struct HashMap *next = current->next;
+
+        current->next = previous;
+        previous = current;
+        current = next;
     }
-    else if (closure->tag == NATIVE_VAR_ARG_CLOSURE_POSITION_VALUE)
+
+    struct HashMapTable *table = current->table;
+
+    while (previous != NULL)
     {
-        struct Value *(*f)(char *, int, int, ...) = closure->native_var_arg_closure_position.native_procedure;
-        return f(closure->native_var_arg_closure_position.file_name, closure->native_var_arg_closure_position.line_number, 9, a1, a2, a3, a4, a5, a6, a7, a8, a9);
+        struct HashMap *towards_map = previous->next;
+        int slot = previous->slot;
+
+        current->table = NULL;
+        current->next = previous;
+        current->slot = slot;
+        current->entry = table->entries[slot];
+        _gc_write_barrier(current);
+
+        table->entries[slot] = previous->entry;
+        previous->table = table;
+        previous->next = NULL;
+        _gc_write_barrier(previous);
+
+        current = previous;
+        previous = towards_map;
     }
-    else
-    {
-        _assert_callable_closure(file_name, line_number, closure, 9);
+    _gc_write_barrier(table);
 
-        struct Value *(*f)(struct Value *, struct Value *, struct Value *, struct Value *, struct Value *, struct Value *, struct Value *, struct Value *, struct Value *, struct Value *) = closure->dynamic_closure.procedure;
+    return table;
+}
 
-        return f(closure->dynamic_closure.frame, a1, a2, a3, a4, a5, a6, a7, a8, a9);
-    }
+/* Returns the version of map, which must be current, whose entry at slot is
+ * replaced by entry.  map is left recording the entry it had.
+ */
+static struct HashMap *_hashmap_update(struct HashMap *map, struct HashMapEntry *slot, struct HashMapEntry entry, int size, int used)
+{
+    struct HashMapTable *table = map->table;
+    struct HashMap *r = _mk_hashmap_version(size, used, table);
+
+    map->table = NULL;
+    map->next = r;
+    map->slot = slot - table->entries;
+    map->entry = *slot;
+    _gc_write_barrier(map);
+
+    *slot = entry;
+    _gc_write_barrier(table);
+
+    return r;
 }
 
-struct Value *_call_closure_10(char *file_name, int line_number, struct Value *closure, struct Value *a1, struct Value *a2, struct Value *a3, struct Value *a4, struct Value *a5, struct Value *a6, struct Value *a7, struct Value *a8, struct Value *a9, struct Value *a10)
+static struct HashMap *_as_hashmap(char *file_name, int line_number, struct Value *v)
 {
-    if (closure->tag == NATIVE_VAR_ARG_CLOSURE_VALUE)
+    if (!IS_POINTER(v) || v->tag != HASHMAP_VALUE)
     {
-        struct Value *(*f)(int, ...) = closure->native_var_arg_closure.native_procedure;
-        return f(10, a1, a2, a3, a4, a5, a6, a7, a8, a9, a10);
+        _exception_throw(file_name, line_number,
+                         _mk_pair(
+                             _from_literal_string("NotMap"),
+                             _mk_pair(
+                                 _mk_pair(_from_literal_string("reason"), _from_literal_string("Attempt to use value as if a map")),
+                                 _mk_pair(
+                                     _mk_pair(_from_literal_string("tag"), _from_literal_int(_value_tag(v))),
+                                     _VNull))));
     }
-    else if (closure->tag == NATIVE_VAR_ARG_CLOSURE_POSITION_VALUE)
+
+    return AS_HASHMAP(v);
+}
+
+struct Value *_map_of(char *file_name, int line_number, int argc, struct Value **argv)
+{
+    if (argc % 2 != 0)
     {
-        struct Value *(*f)(char *, int, int, ...) = closure->native_var_arg_closure_position.native_procedure;
-        return f(closure->native_var_arg_closure_position.file_name, closure->native_var_arg_closure_position.line_number, 10, a1, a2, a3, a4, a5, a6, a7, a8, a9, a10);
+        _exception_throw(file_name, line_number,
+                         _mk_pair(
+                             _from_literal_string("OddArgumentCount"),
+                             _mk_pair(
+                                 _mk_pair(_from_literal_string("reason"), _from_literal_string("map-of expects keys and values in pairs")),
+                                 _mk_pair(
+                                     _mk_pair(_from_literal_string("received"), _from_literal_int(argc)),
+                                     _VNull))));
     }
-    else
-    {
-        _assert_callable_closure(file_name, line_number, closure, 10);
 
-        struct Value *(*f)(struct Value *, struct Value *, struct Value *, struct Value *, struct Value *, struct Value *, struct Value *, struct Value *, struct Value *, struct Value *, struct Value *) = closure->dynamic_closure.procedure;
+    struct HashMap *r = _mk_hashmap(argc / 2);
 
-        return f(closure->dynamic_closure.frame, a1, a2, a3, a4, a5, a6, a7, a8, a9, a10);
-    }
+    for (int i = 0; i < argc; i += 2)
+        _hashmap_insert(r, argv[i], argv[i + 1], _hash_key(argv[i]));
+
+    return (struct Value *)r;
 }
 
-struct Value *_mk_pair(struct Value *car, struct Value *cdr)
+struct Value *_mapp(struct Value *v)
 {
-    struct Value *r = (struct Value *)GC_MALLOC(sizeof(struct Value));
-    r->tag = PAIR_VALUE;
-    r->pair.car = car;
-    r->pair.cdr = cdr;
-    return r;
+    return IS_POINTER(v) && v->tag == HASHMAP_VALUE ? _VTrue : _VFalse;
 }
 
-void _print_newline(void)
+struct Value *_map_size(char *file_name, int line_number, struct Value *map)
 {
-    printf("\n");
+    return FROM_INTEGER(_as_hashmap(file_name, line_number, map)->size);
 }
 
-struct Value *_plus(struct Value *op1, struct Value *op2)
+struct Value *_map_get(char *file_name, int line_number, struct Value *map, struct Value *key)
 {
-    int v1 = op1->tag == INTEGER_VALUE ? op1->integer : 0;
+    struct HashMapTable *table = _hashmap_reroot(_as_hashmap(file_name, line_number, map));
+    struct HashMapEntry *entry = _hashmap_find(table->entries, table->capacity, key, _hash_key(key));
 
-    if (v1 == 0)
-        return op2;
-    else
-    {
-        int v2 = op2->tag == INTEGER_VALUE ? op2->integer : 0;
-        if (v2 == 0)
-            return op1;
-        else
-            return _from_literal_int(v1 + v2);
-    }
+    return entry == NULL ? _VNull : entry->value;
 }
 
-struct Value *_minus(struct Value *op1, struct Value *op2)
+struct Value *_map_containsp(char *file_name, int line_number, struct Value *map, struct Value *key)
 {
-    int v2 = op2->tag == INTEGER_VALUE ? op2->integer : 0;
-    if (v2 == 0)
-        return op1;
-    else
-    {
-        int v1 = op1->tag == INTEGER_VALUE ? op1->integer : 0;
-        return _from_literal_int(v1 - v2);
-    }
+    struct HashMapTable *table = _hashmap_reroot(_as_hashmap(file_name, line_number, map));
+    struct HashMapEntry *entry = _hashmap_find(table->entries, table->capacity, key, _hash_key(key));
+
+    return entry == NULL ? _VFalse : _VTrue;
 }
 
-struct Value *_multiply(struct Value *op1, struct Value *op2)
+/* Both take constant time, amortised over the puts that fill a table, when
+ * given the newest version of a map.  An older version is first made current
+ * at the cost of the number of versions between them.
+ */
+struct Value *_map_put(char *file_name, int line_number, struct Value *map, struct Value *key, struct Value *value)
 {
-    int v1 = op1->tag == INTEGER_VALUE ? op1->integer : 0;
+    struct HashMap *m = _as_hashmap(file_name, line_number, map);
+    struct HashMapTable *table = _hashmap_reroot(m);
+    uintptr_t hash = _hash_key(key);
+    struct HashMapEntry *entry = _hashmap_find(table->entries, table->capacity, key, hash);
 
-    if (v1 == 0)
-        return _from_literal_int(0);
-    else
-    {
-        int v2 = op2->tag == INTEGER_VALUE ? op2->integer : 0;
-        if (v2 == 0)
-            return _from_literal_int(0);
-        else
-            return _from_literal_int(v1 * v2);
-    }
+    if (entry != NULL)
+        return (struct Value *)_hashmap_update(m, entry, (struct HashMapEntry){entry->key, value, hash}, m->size, m->used);
+
+    uintptr_t mask = table->capacity - 1;
+    uintptr_t i = hash & mask;
+
+    while (HASHMAP_LIVE(table->entries + i))
+        i = (i + 1) & mask;
+
+    if (table->entries[i].key == HASHMAP_TOMBSTONE)
+        return (struct Value *)_hashmap_update(m, table->entries + i, (struct HashMapEntry){key, value, hash}, m->size + 1, m->used);
+    if (2 * (m->used + 1) < table->capacity)
+        return (struct Value *)_hashmap_update(m, table->entries + i, (struct HashMapEntry){key, value, hash}, m->size + 1, m->used + 1);
+
+    /* The new table has room for as many entries again so that filling it
+     * takes as many puts as copying into it did
+     */
+    struct HashMap *r = _mk_hashmap(2 * (m->size + 1));
+
+    for (int j = 0; j < table->capacity; j += 1)
+        if (HASHMAP_LIVE(table->entries + j))
+            _hashmap_insert(r, table->entries[j].key, table->entries[j].value, table->entries[j].hash);
+    _hashmap_insert(r, key, value, hash);
+
+    return (struct Value *)r;
 }
 
-struct Value *_divide(char *file_name, int line_number, struct Value *op1, struct Value *op2)
+struct Value *_map_remove(char *file_name, int line_number, struct Value *map, struct Value *key)
 {
-    int v1 = op1->tag == INTEGER_VALUE ? op1->integer : 0;
-    int v2 = op2->tag == INTEGER_VALUE ? op2->integer : 0;
+    struct HashMap *m = _as_hashmap(file_name, line_number, map);
+    struct HashMapTable *table = _hashmap_reroot(m);
+    uintptr_t hash = _hash_key(key);
+    struct HashMapEntry *entry = _hashmap_find(table->entries, table->capacity, key, hash);
 
-    if (v2 == 0)
-    {
-        _exception_throw(file_name, line_number, _from_literal_string("DivideByZero"));
-    }
+    if (entry == NULL)
+        return map;
 
-    return _from_literal_int((int)(v1 / v2));
+    return (struct Value *)_hashmap_update(m, entry, (struct HashMapEntry){HASHMAP_TOMBSTONE, NULL, 0}, m->size - 1, m->used);
 }
 
-struct Value *_equals(struct Value *op1, struct Value *op2)
+/* Builds a map from a list of (key . value) pairs.  Later pairs replace
+ * earlier ones with the same key and anything that is not a pair is
+ * ignored.
+ */
+struct Value *_list_to_map(char *file_name, int line_number, struct Value *list)
 {
-    if (op1->tag != op2->tag)
-        return _VFalse;
+    int length = 0;
 
-    switch (op1->tag)
+    for (struct Value *runner = list; IS_POINTER(runner) && runner->tag == PAIR_VALUE; runner = AS_PAIR(runner)->cdr)
+        length += 1;
+
+    struct HashMap *r = _mk_hashmap(length);
+
+    for (struct Value *runner = list; IS_POINTER(runner) && runner->tag == PAIR_VALUE; runner = AS_PAIR(runner)->cdr)
     {
-    case NULL_VALUE:
-        return _VTrue;
-    case BOOLEAN_VALUE:
-        return (op1->boolean == op2->boolean) ? _VTrue : _VFalse;
-    case INTEGER_VALUE:
-        return (op1->integer == op2->integer) ? _VTrue : _VFalse;
-    case STRING_VALUE:
-        return (strcmp(op1->string, op2->string) == 0) ? _VTrue : _VFalse;
-    case PAIR_VALUE:
-        return _equals(op1->pair.car, op2->pair.car) == _VTrue && _equals(op1->pair.cdr, op2->pair.cdr) == _VTrue ? _VTrue : _VFalse;
-    default:
-        return _VFalse;
+        struct Value *entry = AS_PAIR(runner)->car;
+
+        if (IS_POINTER(entry) && entry->tag == PAIR_VALUE)
+            _hashmap_insert(r, AS_PAIR(entry)->car, AS_PAIR(entry)->cdr, _hash_key(AS_PAIR(entry)->car));
     }
+
+    return (struct Value *)r;
 }
 
-struct Value *_less_than(struct Value *op1, struct Value *op2)
+/* The map's (key . value) pairs in the order of its table.
+ */
+struct Value *_map_to_list(char *file_name, int line_number, struct Value *map)
 {
-    if (op1->tag != op2->tag)
-        return _VFalse;
+    struct HashMapTable *table = _hashmap_reroot(_as_hashmap(file_name, line_number, map));
+    struct Value *result = _VNull;
 
-    switch (op1->tag)
-    {
-    case BOOLEAN_VALUE:
-        return (op1->boolean < op2->boolean) ? _VTrue : _VFalse;
-    case INTEGER_VALUE:
-        return (op1->integer < op2->integer) ? _VTrue : _VFalse;
-    case STRING_VALUE:
-        return (strcmp(op1->string, op2->string) < 0) ? _VTrue : _VFalse;
-    default:
-        return _VFalse;
-    }
+    for (int i = table->capacity - 1; i >= 0; i -= 1)
+        if (HASHMAP_LIVE(table->entries + i))
+            result = _mk_pair(_mk_pair(table->entries[i].key, table->entries[i].value), result);
+
+    return result;
 }
 
-struct Value *_greater_than(struct Value *op1, struct Value *op2)
+struct Value *_map_keys(char *file_name, int line_number, struct Value *map)
 {
-    if (op1->tag != op2->tag)
-        return _VFalse;
+    struct HashMapTable *table = _hashmap_reroot(_as_hashmap(file_name, line_number, map));
+    struct Value *result = _VNull;
 
-    switch (op1->tag)
-    {
-    case BOOLEAN_VALUE:
-        return (op1->boolean > op2->boolean) ? _VTrue : _VFalse;
-    case INTEGER_VALUE:
-        return (op1->integer > op2->integer) ? _VTrue : _VFalse;
-    case STRING_VALUE:
-        return (strcmp(op1->string, op2->string) > 0) ? _VTrue : _VFalse;
-    default:
-        return _VFalse;
-    }
+    for (int i = table->capacity - 1; i >= 0; i -= 1)
+        if (HASHMAP_LIVE(table->entries + i))
+            result = _mk_pair(table->entries[i].key, result);
+
+    return result;
 }
 
-static char *_value_type_name(int tag)
+/* The intern table holds every symbol in an open addressing table keyed on
+ * the hashes of their names.  It is allocated by the collector and reachable
+ * from _symbols so interned symbols live for as long as the program.  Literal
+ * symbols are interned once when a module starts, leaving string->symbol as
+ * the only place a program pays for hashing a name.
+ */
+#define SYMBOLS_INITIAL_CAPACITY 256
+
+static struct Value **_symbols = NULL;
+static int _symbols_size = 0;
+static int _symbols_capacity = 0;
+
+static struct Value **_symbols_find(struct Value **symbols, int capacity, struct StringValue *name, uintptr_t hash)
 {
-    switch (tag)
+    uintptr_t mask = capacity - 1;
+
+    for (uintptr_t i = hash & mask;; i = (i + 1) & mask)
     {
-    case NULL_VALUE:
-        return "()";
-    case BOOLEAN_VALUE:
-        return "boolean";
-    case INTEGER_VALUE:
-        return "integer";
-    case STRING_VALUE:
-        return "string";
-    case PAIR_VALUE:
-        return "pair";
-    default:
-        return "unknown";
+        struct Value *symbol = symbols[i];
+
+        if (symbol == NULL || (AS_SYMBOL(symbol)->hash == hash && _equal_strings(AS_STRING(AS_SYMBOL(symbol)->name), name)))
+            return symbols + i;
     }
 }
 
-struct Value *_pair_car(char *file_name, int line_number, struct Value *pair)
+static void _symbols_grow(void)
 {
-    if (pair->tag == PAIR_VALUE)
-        return pair->pair.car;
+    int capacity = _symbols_capacity == 0 ? SYMBOLS_INITIAL_CAPACITY : 2 * _symbols_capacity;
+    struct Value **symbols = (struct Value **)GC_MALLOC(sizeof(struct Value *) * capacity);
+    memset(symbols, 0, sizeof(struct Value *) * capacity);
 
-    _exception_throw(file_name, line_number,
-                     _mk_pair(
-                         _from_literal_string("EmptyList"),
-                         _mk_pair(
-                             _mk_pair(_from_literal_string("reason"), _from_literal_string("Attempt to call car on empty list")),
-                             _VNull)));
+    for (int i = 0; i < _symbols_capacity; i += 1)
+    {
+        struct Value *symbol = _symbols[i];
 
-    return _VNull;
+        if (symbol != NULL)
+            *_symbols_find(symbols, capacity, AS_STRING(AS_SYMBOL(symbol)->name), AS_SYMBOL(symbol)->hash) = symbol;
+    }
+
+    _symbols = symbols;
+    _symbols_capacity = capacity;
 }
 
-struct Value *_pair_cdr(char *file_name, int line_number, struct Value *pair)
+/* name must be a string.  Strings are never updated so the symbol shares it.
+ */
+struct Value *_intern_symbol(struct Value *name)
 {
-    if (pair->tag == PAIR_VALUE)
-        return pair->pair.cdr;
+    uintptr_t hash = _hash_key(name);
 
-    _exception_throw(file_name, line_number,
-                     _mk_pair(
-                         _from_literal_string("EmptyList"),
-                         _mk_pair(
-                             _mk_pair(_from_literal_string("reason"), _from_literal_string("Attempt to call cdr on empty list")),
-                             _VNull)));
+    if (2 * (_symbols_size + 1) > _symbols_capacity)
+        _symbols_grow();
 
-    return _VNull;
-}
+    struct Value **entry = _symbols_find(_symbols, _symbols_capacity, AS_STRING(name), hash);
 
-struct Value *_nullp(struct Value *v)
-{
-    return v->tag == NULL_VALUE ? _VTrue : _VFalse;
-}
+    if (*entry == NULL)
+    {
+        struct Symbol *symbol = (struct Symbol *)_allocate(SYMBOL_VALUE, sizeof(struct Symbol));
+        symbol->tag = SYMBOL_VALUE;
+        symbol->name = name;
+        symbol->hash = hash;
+
+        *entry = (struct Value *)symbol;
+        _symbols_size += 1;
+        _gc_write_barrier(_symbols);
+    }
 
-struct Value *_booleanp(struct Value *v)
-{
-    return v->tag == BOOLEAN_VALUE ? _VTrue : _VFalse;
+    return *entry;
 }
 
-struct Value *_integerp(struct Value *v)
+struct Value *_symbolp(struct Value *v)
 {
-    return v->tag == INTEGER_VALUE ? _VTrue : _VFalse;
+    return IS_POINTER(v) && v->tag == SYMBOL_VALUE ? _VTrue : _VFalse;
 }
 
-struct Value *_stringp(struct Value *v)
+struct Value *_symbol_to_string(char *file_name, int line_number, struct Value *symbol)
 {
-    return v->tag == STRING_VALUE ? _VTrue : _VFalse;
+    if (!IS_POINTER(symbol) || symbol->tag != SYMBOL_VALUE)
+    {
+        _exception_throw(file_name, line_number,
+                         _mk_pair(
+                             _from_literal_string("NotSymbol"),
+                             _mk_pair(
+                                 _mk_pair(_from_literal_string("reason"), _from_literal_string("Attempt to use value as if a symbol")),
+                                 _mk_pair(
+                                     _mk_pair(_from_literal_string("tag"), _from_literal_int(_value_tag(symbol))),
+                                     _VNull))));
+    }
+
+    return AS_SYMBOL(symbol)->name;
 }
 
-struct Value *_pairp(struct Value *v)
+struct Value *_string_to_symbol(char *file_name, int line_number, struct Value *string)
 {
-    return v->tag == PAIR_VALUE ? _VTrue : _VFalse;
+    if (!IS_POINTER(string) || string->tag != STRING_VALUE)
+    {
+        _exception_throw(file_name, line_number,
+                         _mk_pair(
+                             _from_literal_string("NotString"),
+                             _mk_pair(
+                                 _mk_pair(_from_literal_string("reason"), _from_literal_string("Attempt to use value as if a string")),
+                                 _mk_pair(
+                                     _mk_pair(_from_literal_string("tag"), _from_literal_int(_value_tag(string))),
+                                     _VNull))));
+    }
+
+    return _intern_symbol(string);
 }
 
 void _fail(char *file_name, int line_number, struct Value *msg)
@@ -792,162 +2151,120 @@ void _fail(char *file_name, int line_number, struct Value *msg)
                              _VNull)));
 }
 
-struct Value *_plus_variable(int num, ...)
+struct Value *_plus_variable(int argc, struct Value **argv)
 {
-    if (num == 0)
-        return _from_literal_int(0);
+    if (argc == 0)
+        return FROM_INTEGER(0);
     else
     {
-        va_list arguments;
-
-        va_start(arguments, num);
-        struct Value *result = va_arg(arguments, struct Value *);
-        for (int i = 1; i < num; i++)
+        struct Value *result = argv[0];
+        for (int i = 1; i < argc; i++)
         {
-            result = _plus(result, va_arg(arguments, struct Value *));
+            result = _plus(result, argv[i]);
         }
-        va_end(arguments);
 
         return result;
     }
 }
 
-struct Value *_multiply_variable(int num, ...)
+struct Value *_multiply_variable(int argc, struct Value **argv)
 {
-    if (num == 0)
-        return _from_literal_int(1);
+    if (argc == 0)
+        return FROM_INTEGER(1);
     else
     {
-        va_list arguments;
-
-        va_start(arguments, num);
-        struct Value *result = va_arg(arguments, struct Value *);
-        for (int i = 1; i < num; i++)
+        struct Value *result = argv[0];
+        for (int i = 1; i < argc; i++)
         {
-            result = _multiply(result, va_arg(arguments, struct Value *));
+            result = _multiply(result, argv[i]);
         }
-        va_end(arguments);
 
         return result;
     }
 }
 
-struct Value *_minus_variable(int num, ...)
+struct Value *_minus_variable(int argc, struct Value **argv)
 {
-    switch (num)
+    switch (argc)
     {
     case 0:
-        return _from_literal_int(0);
+        return FROM_INTEGER(0);
     case 1:
-    {
-        va_list arguments;
-
-        struct Value *value;
-        va_start(arguments, num);
-        struct Value *result = _minus(_from_literal_int(0), va_arg(arguments, struct Value *));
-        va_end(arguments);
-
-        return result;
-    }
+        return _minus(FROM_INTEGER(0), argv[0]);
     default:
     {
-        va_list arguments;
-
-        va_start(arguments, num);
-        struct Value *result = va_arg(arguments, struct Value *);
-        for (int i = 1; i < num; i++)
+        struct Value *result = argv[0];
+        for (int i = 1; i < argc; i++)
         {
-            result = _minus(result, va_arg(arguments, struct Value *));
+            result = _minus(result, argv[i]);
         }
-        va_end(arguments);
 
         return result;
     }
     }
 }
 
-struct Value *_divide_variable(char *file_name, int line_number, int num, ...)
+struct Value *_divide_variable(char *file_name, int line_number, int argc, struct Value **argv)
 {
-    switch (num)
+    switch (argc)
     {
     case 0:
-        return _from_literal_int(1);
+        return FROM_INTEGER(1);
     case 1:
-    {
-        va_list arguments;
-
-        struct Value *value;
-        va_start(arguments, num);
-        struct Value *result = _divide(file_name, line_number, _from_literal_int(1), va_arg(arguments, struct Value *));
-        va_end(arguments);
-
-        return result;
-    }
+        return _divide(file_name, line_number, FROM_INTEGER(1), argv[0]);
     default:
     {
-        va_list arguments;
-
-        va_start(arguments, num);
-        struct Value *result = va_arg(arguments, struct Value *);
-        for (int i = 1; i < num; i++)
+        struct Value *result = argv[0];
+        for (int i = 1; i < argc; i++)
         {
-            result = _divide(file_name, line_number, result, va_arg(arguments, struct Value *));
+            result = _divide(file_name, line_number, result, argv[i]);
         }
-        va_end(arguments);
 
         return result;
     }
     }
 }
 
-struct Value *_println(char *file_name, int line_number, int num, ...)
+struct Value *_println(char *file_name, int line_number, int argc, struct Value **argv)
 {
-    va_list arguments;
-
-    va_start(arguments, num);
-    for (int i = 0; i < num; i++)
+    for (int i = 0; i < argc; i++)
     {
-        _print_value(file_name, line_number, va_arg(arguments, struct Value *));
+        _print_value(file_name, line_number, argv[i]);
     }
-    va_end(arguments);
-    printf("\n");
+    _output_newline();
 
     return _VNull;
 }
 
-struct Value *_print(char *file_name, int line_number, int num, ...)
+struct Value *_print(char *file_name, int line_number, int argc, struct Value **argv)
 {
-    va_list arguments;
-
-    va_start(arguments, num);
-    for (int i = 0; i < num; i++)
+    for (int i = 0; i < argc; i++)
     {
-        _print_value(file_name, line_number, va_arg(arguments, struct Value *));
+        _print_value(file_name, line_number, argv[i]);
     }
-    va_end(arguments);
 
     return _VNull;
 }
 
-struct ExceptionTryBlock _exception_try_blocks[100];
-int _exception_try_block_idx;
+/* Exceptions are raised with the Itanium C++ ABI unwinder.  A try compiles
+ * into invokes whose unwind destination is a catch-all landing pad, so
+ * entering a try costs nothing and try blocks nest to any depth.
+ * _exception_personality is the personality routine of every procedure
+ * containing a try: it uses the procedure's LSDA to decide whether the
+ * failing call site has a landing pad.
+ */
+
+#define MIL_EXCEPTION_CLASS 0x4d494c0045584300 /* "MIL\0EXC\0" */
 
-struct Value *_exception_try(char *file_name, int line_number, struct Value *body, struct Value *handler)
+struct Exception
 {
-    _exception_try_block_idx += 1;
-    _exception_try_blocks[_exception_try_block_idx].exception = _VNull;
-    if (setjmp(_exception_try_blocks[_exception_try_block_idx].jmp))
-    {
-        struct Value *exception = _exception_try_blocks[_exception_try_block_idx].exception;
-        _exception_try_block_idx -= 1;
-        return _call_closure_1(file_name, line_number, handler, exception);
-    }
-    else
-    {
-        struct Value *result = _call_closure_0(file_name, line_number, body);
-        _exception_try_block_idx -= 1;
-        return result;
-    }
+    struct _Unwind_Exception header;
+    struct Value *value;
+};
+
+static void _exception_cleanup(_Unwind_Reason_Code reason, struct _Unwind_Exception *exception)
+{
+    GC_FREE(exception);
 }
 
 void _exception_throw(char *file_name, int line_number, struct Value *exception)
@@ -961,6 +2278,182 @@ void _exception_throw(char *file_name, int line_number, struct Value *exception)
                     _from_literal_int(line_number),
                     _VNull)));
 
-    _exception_try_blocks[_exception_try_block_idx].exception = exception_value;
-    longjmp(_exception_try_blocks[_exception_try_block_idx].jmp, 0);
+    /* Uncollectable so that the value stays reachable while the stack unwinds */
+    struct Exception *e = (struct Exception *)GC_MALLOC_UNCOLLECTABLE(sizeof(struct Exception));
+    e->header.exception_class = MIL_EXCEPTION_CLASS;
+    e->header.exception_cleanup = _exception_cleanup;
+    e->value = exception_value;
+
+    _Unwind_RaiseException(&e->header);
+
+    /* No landing pad wants the exception */
+    _output_string("Unhandled Exception: ");
+    _print_value("", 0, exception_value);
+    _output_char('\n');
+    _flush_output();
+    exit(1);
+}
+
+/* Called on entry to a landing pad with the exception object passed by the
+ * personality routine.
+ */
+struct Value *_exception_catch(void *exception)
+{
+    struct Exception *e = (struct Exception *)exception;
+    struct Value *value = e->value;
+
+    GC_FREE(e);
+
+    return value;
+}
+
+#define DW_EH_PE_omit 0xff
+#define DW_EH_PE_absptr 0x00
+#define DW_EH_PE_uleb128 0x01
+#define DW_EH_PE_udata2 0x02
+#define DW_EH_PE_udata4 0x03
+#define DW_EH_PE_udata8 0x04
+#define DW_EH_PE_sleb128 0x09
+#define DW_EH_PE_sdata2 0x0a
+#define DW_EH_PE_sdata4 0x0b
+#define DW_EH_PE_sdata8 0x0c
+
+static uintptr_t _read_uleb128(const uint8_t **p)
+{
+    uintptr_t result = 0;
+    int shift = 0;
+    uint8_t byte;
+
+    do
+    {
+        byte = **p;
+        *p += 1;
+        result |= ((uintptr_t)(byte & 0x7f)) << shift;
+        shift += 7;
+    } while (byte & 0x80);
+
+    return result;
+}
+
+static intptr_t _read_sleb128(const uint8_t **p)
+{
+    uintptr_t result = 0;
+    int shift = 0;
+    uint8_t byte;
+
+    do
+    {
+        byte = **p;
+        *p += 1;
+        result |= ((uintptr_t)(byte & 0x7f)) << shift;
+        shift += 7;
+    } while (byte & 0x80);
+
+    if (shift < 8 * (int)sizeof(result) && (byte & 0x40))
+        result |= -((uintptr_t)1 << shift);
+
+    return (intptr_t)result;
+}
+
+/* Reads a value from the call-site table.  These are offsets so only the
+ * format part of the encoding applies.
+ */
+static uintptr_t _read_encoded(const uint8_t **p, uint8_t encoding)
+{
+    uintptr_t result;
+
+    switch (encoding & 0x0f)
+    {
+    case DW_EH_PE_absptr:
+        memcpy(&result, *p, sizeof(result));
+        *p += sizeof(result);
+        return result;
+    case DW_EH_PE_uleb128:
+        return _read_uleb128(p);
+    case DW_EH_PE_sleb128:
+        return (uintptr_t)_read_sleb128(p);
+    case DW_EH_PE_udata2:
+    case DW_EH_PE_sdata2:
+    {
+        uint16_t v;
+        memcpy(&v, *p, sizeof(v));
+        *p += sizeof(v);
+        return (encoding & 0x0f) == DW_EH_PE_sdata2 ? (uintptr_t)(int16_t)v : v;
+    }
+    case DW_EH_PE_udata4:
+    case DW_EH_PE_sdata4:
+    {
+        uint32_t v;
+        memcpy(&v, *p, sizeof(v));
+        *p += sizeof(v);
+        return (encoding & 0x0f) == DW_EH_PE_sdata4 ? (uintptr_t)(int32_t)v : v;
+    }
+    case DW_EH_PE_udata8:
+    case DW_EH_PE_sdata8:
+    {
+        uint64_t v;
+        memcpy(&v, *p, sizeof(v));
+        *p += sizeof(v);
+        return (uintptr_t)v;
+    }
+    default:
+        abort();
+    }
+}
+
+/* Every landing pad emitted by the compiler is a catch-all so a call site
+ * with a landing pad always handles the exception.
+ */
+_Unwind_Reason_Code _exception_personality(int version, _Unwind_Action actions, uint64_t exception_class,
+                                           struct _Unwind_Exception *exception, struct _Unwind_Context *context)
+{
+    if (version != 1 || exception_class != MIL_EXCEPTION_CLASS)
+        return _URC_CONTINUE_UNWIND;
+
+    const uint8_t *lsda = (const uint8_t *)_Unwind_GetLanguageSpecificData(context);
+    if (lsda == NULL)
+        return _URC_CONTINUE_UNWIND;
+
+    uintptr_t function_start = _Unwind_GetRegionStart(context);
+    uintptr_t ip = _Unwind_GetIP(context) - 1;
+
+    const uint8_t *p = lsda;
+    uint8_t landing_pad_start_encoding = *p++;
+    uintptr_t landing_pad_start = landing_pad_start_encoding == DW_EH_PE_omit ? function_start : _read_encoded(&p, landing_pad_start_encoding);
+
+    uint8_t type_table_encoding = *p++;
+    if (type_table_encoding != DW_EH_PE_omit)
+        _read_uleb128(&p);
+
+    uint8_t call_site_encoding = *p++;
+    uintptr_t call_site_table_length = _read_uleb128(&p);
+    const uint8_t *call_site_table_end = p + call_site_table_length;
+
+    while (p < call_site_table_end)
+    {
+        uintptr_t start = _read_encoded(&p, call_site_encoding);
+        uintptr_t length = _read_encoded(&p, call_site_encoding);
+        uintptr_t landing_pad = _read_encoded(&p, call_site_encoding);
+        _read_uleb128(&p);
+
+        if (ip < function_start + start)
+            break;
+
+        if (ip < function_start + start + length)
+        {
+            if (landing_pad == 0)
+                return _URC_CONTINUE_UNWIND;
+
+            if (actions & _UA_SEARCH_PHASE)
+                return _URC_HANDLER_FOUND;
+
+            _Unwind_SetGR(context, __builtin_eh_return_data_regno(0), (uintptr_t)exception);
+            _Unwind_SetGR(context, __builtin_eh_return_data_regno(1), 1);
+            _Unwind_SetIP(context, landing_pad_start + landing_pad);
+
+            return _URC_INSTALL_CONTEXT;
+        }
+    }
+
+    return _URC_CONTINUE_UNWIND;
 }
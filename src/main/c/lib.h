@@ -1,7 +1,7 @@
 #ifndef __LIB_H__
 #define __LIB_H__
 
-#include <setjmp.h>
+#include <stdint.h>
 
 #define NULL_VALUE 0
 #define BOOLEAN_VALUE 1
@@ -9,88 +9,215 @@
 #define STRING_VALUE 3
 #define PAIR_VALUE 4
 #define VECTOR_VALUE 5
-#define NATIVE_CLOSURE_VALUE 6
-#define NATIVE_VAR_ARG_CLOSURE_VALUE 7
-#define NATIVE_VAR_ARG_CLOSURE_POSITION_VALUE 8
-#define DYNAMIC_CLOSURE_VALUE 9
+#define CLOSURE_VALUE 6
+#define CHARACTER_VALUE 7
+#define FRAME_VALUE 8
+#define INT32_ARRAY_VALUE 9
+#define HASHMAP_VALUE 10
+#define SYMBOL_VALUE 11
 
+/* A struct Value * is a tagged word.  Heap values are pointers with the low
+ * IMMEDIATE_BITS clear.  Integers, characters, booleans and () are immediates
+ * held in the word itself so creating them never allocates.  The encoding
+ * assumes 64-bit pointers and is mirrored by the compiler in Context.kt.
+ */
+#define IMMEDIATE_BITS 3
+#define IMMEDIATE_MASK 7
+
+#define POINTER_IMMEDIATE 0
+#define INTEGER_IMMEDIATE 1
+#define CHARACTER_IMMEDIATE 2
+#define CONSTANT_IMMEDIATE 3
+
+#define MK_IMMEDIATE(v, t) ((struct Value *)((((uintptr_t)(intptr_t)(v)) << IMMEDIATE_BITS) | (t)))
+#define IMMEDIATE_TAG(v) (((uintptr_t)(v)) & IMMEDIATE_MASK)
+
+#define IS_POINTER(v) (IMMEDIATE_TAG(v) == POINTER_IMMEDIATE)
+#define IS_INTEGER(v) (IMMEDIATE_TAG(v) == INTEGER_IMMEDIATE)
+#define IS_CHARACTER(v) (IMMEDIATE_TAG(v) == CHARACTER_IMMEDIATE)
+#define IS_BOOLEAN(v) ((v) == _VTrue || (v) == _VFalse)
+
+#define FROM_INTEGER(i) MK_IMMEDIATE((int)(i), INTEGER_IMMEDIATE)
+#define INTEGER_OF(v) ((int)(((intptr_t)(v)) >> IMMEDIATE_BITS))
+#define FROM_CHARACTER(c) MK_IMMEDIATE((unsigned char)(c), CHARACTER_IMMEDIATE)
+#define CHARACTER_OF(v) ((unsigned char)(((uintptr_t)(v)) >> IMMEDIATE_BITS))
+
+#define _VNull MK_IMMEDIATE(0, CONSTANT_IMMEDIATE)
+#define _VFalse MK_IMMEDIATE(1, CONSTANT_IMMEDIATE)
+#define _VTrue MK_IMMEDIATE(2, CONSTANT_IMMEDIATE)
+
+/* Every heap value starts with the same compact header and is allocated at
+ * exactly the size of its variant.  Code holding a struct Value * reads the
+ * tag and then uses the matching AS_* view.
+ */
 struct Value
 {
     int tag;
-    union
-    {
-        int boolean;
-        int integer;
-        char *string;
-        struct Pair
-        {
-            struct Value *car;
-            struct Value *cdr;
-        } pair;
-        struct Vector
-        {
-            int length;
-            struct Value **items;
-        } vector;
-        struct NativeClosure
-        {
-            void *procedure;
-            int number_arguments;
-            void *native_procedure;
-        } native_closure;
-        struct NativeVarArgClosure
-        {
-            void *native_procedure;
-        } native_var_arg_closure;
-        struct NativeVarArgClosurePosition
-        {
-            void *native_procedure;
-            char *file_name;
-            int line_number;
-        } native_var_arg_closure_position;
-        struct DynamicClosure
-        {
-            void *procedure;
-            int number_arguments;
-            struct Value *frame;
-        } dynamic_closure;
-    };
 };
 
-extern struct Value *_VNull;
-extern struct Value *_VTrue;
-extern struct Value *_VFalse;
+/* String bodies are stored inline and hold no pointers so the whole value is
+ * allocated with GC_MALLOC_ATOMIC.  length excludes the trailing '\0' which is
+ * kept only for the convenience of C callers.
+ */
+struct StringValue
+{
+    int tag;
+    int length;
+    char string[];
+};
+
+struct Pair
+{
+    int tag;
+    struct Value *car;
+    struct Value *cdr;
+};
+
+/* Vectors hold their items inline after the header so indexing is a single
+ * load.  They are never updated once built.  Frames and environments share
+ * the layout but are tagged FRAME_VALUE so they are never taken for vectors.
+ */
+struct Vector
+{
+    int tag;
+    int length;
+    struct Value *items[];
+};
+
+/* Int32 arrays hold no pointers so they are allocated with GC_MALLOC_ATOMIC.
+ */
+struct Int32Array
+{
+    int tag;
+    int length;
+    int32_t items[];
+};
+
+/* An entry is empty when its key is NULL, which is never a value, and
+ * removed when its key is HASHMAP_TOMBSTONE, a constant immediate that no
+ * program can construct.  hash caches the key's hash so probes and copies
+ * need not recompute it.
+ */
+#define HASHMAP_TOMBSTONE MK_IMMEDIATE(21, CONSTANT_IMMEDIATE)
+
+struct HashMapEntry
+{
+    struct Value *key;
+    struct Value *value;
+    uintptr_t hash;
+};
+
+struct HashMapTable
+{
+    int capacity;
+    struct HashMapEntry entries[];
+};
+
+/* map-put and map-remove leave the map they are given unchanged, yet update
+ * a single table in place.  Every version of a map shares the table but only
+ * one version, whose table is not NULL, reads it directly.  Each of the
+ * others records the entry at slot in which it differs from the version
+ * next.  A version is made current by walking its chain to the table,
+ * swapping each recorded entry with the table's.
+ *
+ * used counts the entries that are not empty, removed ones included, so
+ * that a probe always finds an empty entry.
+ */
+struct HashMap
+{
+    int tag;
+    int size;
+    int used;
+    int slot;
+    struct HashMapTable *table;
+    struct HashMap *next;
+    struct HashMapEntry entry;
+};
+
+/* Symbols are interned - there is only ever one symbol with a given name - so
+ * two symbols are equal exactly when they are the same value.  hash is the
+ * hash of name computed once when the symbol is interned.
+ */
+struct Symbol
+{
+    int tag;
+    struct Value *name;
+    uintptr_t hash;
+};
+
+/* Every procedure value, native or compiled, is a Closure.  A call passing
+ * number_arguments arguments calls entry directly with those arguments
+ * followed by frame - procedures without a frame ignore the extra argument.
+ * Every other call goes through generic which reports an argument count
+ * mismatch or, for natives taking a variable number of arguments where
+ * number_arguments is -1, calls entry with the arguments it was passed.
+ */
+struct Closure
+{
+    int tag;
+    int number_arguments;
+    void *entry;
+    struct Value *(*generic)(char *file_name, int line_number, int argc, struct Value **argv, struct Value *closure);
+    struct Value *frame;
+};
+
+/* A program compiled with --profile keeps a shadow stack of the mini-iLisp
+ * procedures being run.  Each procedure links a ProfileFrame from its native
+ * stack onto _profile_top on entry and unlinks it on return or before a call
+ * in tail position.  line is the line of the call the procedure most recently
+ * made, or 0 before it has made one.
+ */
+struct ProfileFrame
+{
+    struct ProfileFrame *parent;
+    char *name;
+    int line;
+};
+
+extern struct ProfileFrame *volatile _profile_top;
+
+/* A program compiled with --profile-allocations stores the position of each
+ * call into these before making it.  Values allocated are counted against it.
+ */
+extern char *_allocation_file_name;
+extern int _allocation_line_number;
+
+#define AS_STRING(v) ((struct StringValue *)(v))
+#define AS_PAIR(v) ((struct Pair *)(v))
+#define AS_VECTOR(v) ((struct Vector *)(v))
+#define AS_CLOSURE(v) ((struct Closure *)(v))
+#define AS_INT32_ARRAY(v) ((struct Int32Array *)(v))
+#define AS_HASHMAP(v) ((struct HashMap *)(v))
+#define AS_SYMBOL(v) ((struct Symbol *)(v))
 
 extern void _initialise_lib();
 
+/* Called after a value is stored into a heap value that may have been
+ * allocated before the value stored.  Compiled code calls it after storing
+ * into a frame or box that is not on the stack.
+ */
+extern void _gc_write_barrier(void *object);
+
 extern void _print_value(char *file_name, int line_number, struct Value *value);
 extern void _print_newline(void);
+extern void _flush_output(void);
 
 extern struct Value *_from_literal_int(int v);
 extern struct Value *_from_literal_string(char *s);
+extern struct Value *_mk_string(char *s, int length);
 extern struct Value *_mk_pair(struct Value *car, struct Value *cdr);
-extern struct Value *_from_native_var_arg_procedure(void *procedure);
-extern struct Value *_from_native_var_arg_position_procedure(char *file_name, int line_number, void *procedure);
-extern struct Value *_from_native_procedure(char *file_name, int line_number, void *procedure, int number_arguments);
 extern struct Value *_from_dynamic_procedure(void *procedure, int number_arguments, struct Value *frame);
 
-extern void _assert_callable_closure(char *file_name, int line_number, struct Value *closure, int number_arguments);
 extern struct Value *_mk_frame(struct Value *parent, int size);
+extern struct Value *_mk_environment(int size);
 extern struct Value *_get_frame_value(struct Value *frame, int depth, int offset);
 extern void _set_frame_value(struct Value *frame, int depth, int offset, struct Value *value);
 extern struct Value *_get_frame(struct Value *frame, int depth);
 
-extern struct Value *_call_closure_0(char *file_name, int line_number, struct Value *closure);
-extern struct Value *_call_closure_1(char *file_name, int line_number, struct Value *closure, struct Value *a1);
-extern struct Value *_call_closure_2(char *file_name, int line_number, struct Value *closure, struct Value *a1, struct Value *a2);
-extern struct Value *_call_closure_3(char *file_name, int line_number, struct Value *closure, struct Value *a1, struct Value *a2, struct Value *a3);
-extern struct Value *_call_closure_4(char *file_name, int line_number, struct Value *closure, struct Value *a1, struct Value *a2, struct Value *a3, struct Value *a4);
-extern struct Value *_call_closure_5(char *file_name, int line_number, struct Value *closure, struct Value *a1, struct Value *a2, struct Value *a3, struct Value *a4, struct Value *a5);
-extern struct Value *_call_closure_6(char *file_name, int line_number, struct Value *closure, struct Value *a1, struct Value *a2, struct Value *a3, struct Value *a4, struct Value *a5, struct Value *a6);
-extern struct Value *_call_closure_7(char *file_name, int line_number, struct Value *closure, struct Value *a1, struct Value *a2, struct Value *a3, struct Value *a4, struct Value *a5, struct Value *a6, struct Value *a7);
-extern struct Value *_call_closure_8(char *file_name, int line_number, struct Value *closure, struct Value *a1, struct Value *a2, struct Value *a3, struct Value *a4, struct Value *a5, struct Value *a6, struct Value *a7, struct Value *a8);
-extern struct Value *_call_closure_9(char *file_name, int line_number, struct Value *closure, struct Value *a1, struct Value *a2, struct Value *a3, struct Value *a4, struct Value *a5, struct Value *a6, struct Value *a7, struct Value *a8, struct Value *a9);
-extern struct Value *_call_closure_10(char *file_name, int line_number, struct Value *closure, struct Value *a1, struct Value *a2, struct Value *a3, struct Value *a4, struct Value *a5, struct Value *a6, struct Value *a7, struct Value *a8, struct Value *a9, struct Value *a10);
+extern struct Value *_call_closure(char *file_name, int line_number, struct Value *closure, int argc, struct Value **argv);
+extern struct Value *_closure_argument_mismatch(char *file_name, int line_number, int argc, struct Value **argv, struct Value *closure);
+extern struct Value *_call_native_var_arg(char *file_name, int line_number, int argc, struct Value **argv, struct Value *closure);
+extern struct Value *_call_native_var_arg_position(char *file_name, int line_number, int argc, struct Value **argv, struct Value *closure);
 
 extern struct Value *_plus(struct Value *op1, struct Value *op2);
 extern struct Value *_minus(struct Value *op1, struct Value *op2);
@@ -107,22 +234,57 @@ extern struct Value *_integerp(struct Value *v);
 extern struct Value *_stringp(struct Value *v);
 extern struct Value *_pairp(struct Value *v);
 
-extern struct Value* _plus_variable(int num, ...);
-extern struct Value* _multiply_variable(int num, ...);
-extern struct Value* _minus_variable(int num, ...);
-extern struct Value* _divide_variable(char *file_name, int line_number, int num, ...);
-extern struct Value* _println(char *file_name, int line_number, int num, ...);
-extern struct Value* _print(char *file_name, int line_number, int num, ...);
+extern struct Value *_vector(int argc, struct Value **argv);
+extern struct Value *_vectorp(struct Value *v);
+extern struct Value *_vector_length(char *file_name, int line_number, struct Value *vector);
+extern struct Value *_vector_ref(char *file_name, int line_number, struct Value *vector, struct Value *index);
+extern struct Value *_vector_set(char *file_name, int line_number, struct Value *vector, struct Value *index, struct Value *value);
+extern struct Value *_vector_slice(char *file_name, int line_number, struct Value *vector, struct Value *start, struct Value *end);
+extern struct Value *_vector_to_list(char *file_name, int line_number, struct Value *vector);
+extern struct Value *_list_to_vector(char *file_name, int line_number, struct Value *list);
 
-struct ExceptionTryBlock {
-  jmp_buf jmp;
-  struct Value *exception;
-};
+extern struct Value *_int32_array(char *file_name, int line_number, int argc, struct Value **argv);
+extern struct Value *_int32_arrayp(struct Value *v);
+extern struct Value *_int32_array_range(char *file_name, int line_number, struct Value *start, struct Value *end);
+extern struct Value *_int32_array_length(char *file_name, int line_number, struct Value *array);
+extern struct Value *_int32_array_ref(char *file_name, int line_number, struct Value *array, struct Value *index);
+extern struct Value *_vector_to_int32_array(char *file_name, int line_number, struct Value *vector);
+extern struct Value *_int32_array_to_vector(char *file_name, int line_number, struct Value *array);
+extern struct Value *_int32_array_sum(char *file_name, int line_number, struct Value *array);
+extern struct Value *_int32_array_min(char *file_name, int line_number, struct Value *array);
+extern struct Value *_int32_array_max(char *file_name, int line_number, struct Value *array);
+extern struct Value *_int32_array_dot(char *file_name, int line_number, struct Value *array1, struct Value *array2);
+extern struct Value *_int32_array_add(char *file_name, int line_number, struct Value *array1, struct Value *array2);
+extern struct Value *_int32_array_multiply(char *file_name, int line_number, struct Value *array1, struct Value *array2);
+extern struct Value *_int32_array_prefix_sum(char *file_name, int line_number, struct Value *array);
+
+extern struct Value *_map_of(char *file_name, int line_number, int argc, struct Value **argv);
+extern struct Value *_mapp(struct Value *v);
+extern struct Value *_map_size(char *file_name, int line_number, struct Value *map);
+extern struct Value *_map_get(char *file_name, int line_number, struct Value *map, struct Value *key);
+extern struct Value *_map_containsp(char *file_name, int line_number, struct Value *map, struct Value *key);
+extern struct Value *_map_put(char *file_name, int line_number, struct Value *map, struct Value *key, struct Value *value);
+extern struct Value *_map_remove(char *file_name, int line_number, struct Value *map, struct Value *key);
+extern struct Value *_list_to_map(char *file_name, int line_number, struct Value *list);
+extern struct Value *_map_to_list(char *file_name, int line_number, struct Value *map);
+extern struct Value *_map_keys(char *file_name, int line_number, struct Value *map);
+
+extern struct Value *_intern_symbol(struct Value *name);
+extern struct Value *_symbolp(struct Value *v);
+extern struct Value *_symbol_to_string(char *file_name, int line_number, struct Value *symbol);
+extern struct Value *_string_to_symbol(char *file_name, int line_number, struct Value *string);
 
-extern struct ExceptionTryBlock _exception_try_blocks[];
-extern int _exception_try_block_idx;
+/* Natives taking a variable number of arguments are passed them as an
+ * array, built by the caller on its stack, rather than as C varargs.
+ */
+extern struct Value* _plus_variable(int argc, struct Value **argv);
+extern struct Value* _multiply_variable(int argc, struct Value **argv);
+extern struct Value* _minus_variable(int argc, struct Value **argv);
+extern struct Value* _divide_variable(char *file_name, int line_number, int argc, struct Value **argv);
+extern struct Value* _println(char *file_name, int line_number, int argc, struct Value **argv);
+extern struct Value* _print(char *file_name, int line_number, int argc, struct Value **argv);
 
-extern struct Value *_exception_try(char *file_name, int line_number, struct Value *body, struct Value *handler);
 extern void _exception_throw(char *file_name, int line_number, struct Value *exception);
+extern struct Value *_exception_catch(void *exception);
 
 #endif
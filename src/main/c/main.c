@@ -1,5 +1,9 @@
+#include <signal.h>
 #include <stdio.h>
-#include <setjmp.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <time.h>
 
 #include "../../../bdwgc/include/gc.h"
 
@@ -7,49 +11,357 @@
 
 extern int _main(int n);
 
-int main(int argc, char *argv[])
+/* Collector settings are read from the environment so that a heap can be
+ * tuned per workload without rebuilding:
+ *
+ *   MIL_INITIAL_HEAP    bytes to grow the heap to at start, with an optional
+ *                       K, M or G suffix
+ *   MIL_GC_INCREMENTAL  collect incrementally
+ *   MIL_GC_MARKERS      number of parallel marker threads - passed on as
+ *                       GC_MARKERS as bdwgc only honours it when built with
+ *                       parallel marking
+ *   MIL_GC_STATS        report the collector's statistics as JSON at exit,
+ *                       to the named file or, when set to 1, to stderr
+ *
+ * Only the calls made here are needed of a collector, so programs linked
+ * with nursery.c read the same settings.
+ */
+#define PAUSE_BUCKETS 24
+
+static struct
+{
+  int reported;
+  unsigned long collections;
+  double total_pause_us;
+  double max_pause_us;
+  unsigned long histogram[PAUSE_BUCKETS];
+  struct timespec started;
+} _gc_stats;
+
+static double _elapsed_us(struct timespec *start, struct timespec *end)
+{
+  return (end->tv_sec - start->tv_sec) * 1e6 + (end->tv_nsec - start->tv_nsec) / 1e3;
+}
+
+/* Runs inside the collector so it must not allocate.  Pauses are counted in
+ * buckets whose upper bounds are successive powers of two microseconds.
+ */
+static void _on_collection_event(GC_EventType event)
 {
+  if (event == GC_EVENT_START)
+    clock_gettime(CLOCK_MONOTONIC, &_gc_stats.started);
+  else if (event == GC_EVENT_END)
+  {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    double pause = _elapsed_us(&_gc_stats.started, &now);
+    int bucket = 0;
+
+    while (bucket < PAUSE_BUCKETS - 1 && (double)(1UL << bucket) < pause)
+      bucket += 1;
+
+    _gc_stats.collections += 1;
+    _gc_stats.total_pause_us += pause;
+    if (pause > _gc_stats.max_pause_us)
+      _gc_stats.max_pause_us = pause;
+    _gc_stats.histogram[bucket] += 1;
+  }
+}
+
+/* Reported from main before the collector is shut down or, when the program
+ * exits early, from atexit.
+ */
+static void _report_gc_stats(void)
+{
+  if (_gc_stats.reported)
+    return;
+  _gc_stats.reported = 1;
+
+  char *destination = getenv("MIL_GC_STATS");
+  FILE *out = destination[0] == '\0' || (destination[0] == '1' && destination[1] == '\0') ? stderr : fopen(destination, "w");
+
+  if (out == NULL)
+  {
+    perror(destination);
+    return;
+  }
+
+  fprintf(out, "{\"heap_size\": %lu, \"free_bytes\": %lu, \"total_allocated\": %lu, \"collections\": %lu, ",
+          (unsigned long)GC_get_heap_size(), (unsigned long)GC_get_free_bytes(), (unsigned long)GC_get_total_bytes(), _gc_stats.collections);
+  fprintf(out, "\"total_pause_us\": %.0f, \"max_pause_us\": %.0f, \"pause_histogram_us\": [",
+          _gc_stats.total_pause_us, _gc_stats.max_pause_us);
+
+  int separator = 0;
+  for (int bucket = 0; bucket < PAUSE_BUCKETS; bucket += 1)
+    if (_gc_stats.histogram[bucket] > 0)
+    {
+      if (bucket == PAUSE_BUCKETS - 1)
+        fprintf(out, "%s{\"le\": null, \"count\": %lu}", separator ? ", " : "", _gc_stats.histogram[bucket]);
+      else
+        fprintf(out, "%s{\"le\": %lu, \"count\": %lu}", separator ? ", " : "", 1UL << bucket, _gc_stats.histogram[bucket]);
+      separator = 1;
+    }
+  fprintf(out, "]}\n");
+
+  if (out != stderr)
+    fclose(out);
+}
+
+static size_t _size_setting(char *value)
+{
+  char *suffix;
+  size_t size = strtoul(value, &suffix, 10);
+
+  switch (*suffix)
+  {
+  case 'g':
+  case 'G':
+    return size << 30;
+  case 'm':
+  case 'M':
+    return size << 20;
+  case 'k':
+  case 'K':
+    return size << 10;
+  default:
+    return size;
+  }
+}
+
+static void _initialise_gc(void)
+{
+  char *markers = getenv("MIL_GC_MARKERS");
+  if (markers != NULL)
+    setenv("GC_MARKERS", markers, 1);
+
   GC_INIT();
 
-  _initialise_lib();
+  if (getenv("MIL_GC_INCREMENTAL") != NULL)
+    GC_enable_incremental();
+
+  char *initial_heap = getenv("MIL_INITIAL_HEAP");
+  if (initial_heap != NULL)
+  {
+    size_t size = _size_setting(initial_heap);
+    size_t heap_size = GC_get_heap_size();
+
+    if (size > heap_size)
+      GC_expand_hp(size - heap_size);
+  }
+
+  if (getenv("MIL_GC_STATS") != NULL)
+  {
+    GC_set_on_collection_event(_on_collection_event);
+    atexit(_report_gc_stats);
+  }
+}
+
+/* With MIL_PROFILE set a SIGPROF timer samples the shadow stack kept by code
+ * compiled with --profile.  Identical stacks are counted together and
+ * written at exit as folded stacks, one line of root-first frames separated
+ * by ; and followed by a count, as read by flamegraph.pl:
+ *
+ *   MIL_PROFILE           write the folded stacks to the named file or, when
+ *                         set to 1, to stderr
+ *   MIL_PROFILE_INTERVAL  microseconds of CPU time between samples, by
+ *                         default 1000
+ *
+ * The handler cannot allocate so stacks are counted in tables allocated at
+ * start.  Samples taken once the tables are full are counted as dropped and
+ * only the PROFILE_MAX_DEPTH innermost frames of a deeper stack are kept.
+ */
+#define PROFILE_STACKS 8192
+#define PROFILE_FRAMES (1 << 18)
+#define PROFILE_MAX_DEPTH 128
+
+struct ProfileFrame *volatile _profile_top = NULL;
+
+struct ProfileLocation
+{
+  char *name;
+  int line;
+};
 
-  int result = 0;
+struct ProfileStack
+{
+  unsigned long count;
+  int depth;
+  int truncated;
+  struct ProfileLocation *frames;
+};
+
+static struct
+{
+  int reported;
+  struct ProfileStack *stacks;
+  int stacks_size;
+  struct ProfileLocation *frames;
+  int frames_size;
+  unsigned long dropped;
+} _profile;
+
+static int _same_stack(struct ProfileStack *stack, struct ProfileLocation *frames, int depth, int truncated)
+{
+  if (stack->depth != depth || stack->truncated != truncated)
+    return 0;
+
+  for (int i = 0; i < depth; i += 1)
+    if (stack->frames[i].name != frames[i].name || stack->frames[i].line != frames[i].line)
+      return 0;
 
-  _exception_try_block_idx += 1;
-  _exception_try_blocks[_exception_try_block_idx].exception = _VNull;
-  if (setjmp(_exception_try_blocks[_exception_try_block_idx].jmp))
+  return 1;
+}
+
+static void _on_profile_sample(int signal)
+{
+  (void)signal;
+
+  struct ProfileLocation frames[PROFILE_MAX_DEPTH];
+  int depth = 0;
+  uintptr_t hash = 0;
+  struct ProfileFrame *frame = _profile_top;
+
+  while (frame != NULL && depth < PROFILE_MAX_DEPTH)
   {
-    printf("Unhandled Exception: ");
-    _print_value("", 0, _exception_try_blocks[_exception_try_block_idx].exception);
-    _print_newline();
-    _exception_try_block_idx -= 1;
-    result = 1;
+    frames[depth].name = frame->name;
+    frames[depth].line = frame->line;
+    hash = (hash ^ (uintptr_t)frame->name ^ (uintptr_t)frame->line) * 0x100000001b3;
+    depth += 1;
+    frame = frame->parent;
   }
-  else
+  int truncated = frame != NULL;
+
+  uintptr_t index = (hash ^ (hash >> 29)) % PROFILE_STACKS;
+  for (int probes = 0; probes < PROFILE_STACKS; probes += 1)
+  {
+    struct ProfileStack *stack = &_profile.stacks[index];
+
+    if (stack->frames == NULL)
+    {
+      if (_profile.stacks_size == PROFILE_STACKS * 3 / 4 || _profile.frames_size + depth > PROFILE_FRAMES)
+        break;
+
+      stack->frames = _profile.frames + _profile.frames_size;
+      memcpy(stack->frames, frames, depth * sizeof(struct ProfileLocation));
+      stack->depth = depth;
+      stack->truncated = truncated;
+      stack->count = 1;
+      _profile.frames_size += depth;
+      _profile.stacks_size += 1;
+      return;
+    }
+    if (_same_stack(stack, frames, depth, truncated))
+    {
+      stack->count += 1;
+      return;
+    }
+    index = (index + 1) % PROFILE_STACKS;
+  }
+
+  _profile.dropped += 1;
+}
+
+/* Stops sampling before writing the stacks so that the handler does not
+ * update them while they are being read.
+ */
+static void _report_profile(void)
+{
+  if (_profile.reported)
+    return;
+  _profile.reported = 1;
+
+  struct itimerval stop = {{0, 0}, {0, 0}};
+  setitimer(ITIMER_PROF, &stop, NULL);
+  signal(SIGPROF, SIG_IGN);
+
+  char *destination = getenv("MIL_PROFILE");
+  FILE *out = destination[0] == '\0' || (destination[0] == '1' && destination[1] == '\0') ? stderr : fopen(destination, "w");
+
+  if (out == NULL)
   {
-    _main(0);
-    _exception_try_block_idx -= 1;
-    result = 0;
+    perror(destination);
+    return;
   }
 
-  // struct GC_prof_stats_s stats;
-  // GC_get_prof_stats(&stats, 0);
+  for (int index = 0; index < PROFILE_STACKS; index += 1)
+  {
+    struct ProfileStack *stack = &_profile.stacks[index];
+
+    if (stack->frames == NULL)
+      continue;
+
+    if (stack->truncated)
+      fprintf(out, "[truncated];");
+    if (stack->depth == 0)
+      fprintf(out, "[native]");
+    for (int i = stack->depth - 1; i >= 0; i -= 1)
+    {
+      if (stack->frames[i].line == 0)
+        fprintf(out, "%s", stack->frames[i].name);
+      else
+        fprintf(out, "%s:%d", stack->frames[i].name, stack->frames[i].line);
+      if (i > 0)
+        fputc(';', out);
+    }
+    fprintf(out, " %lu\n", stack->count);
+  }
+  if (_profile.dropped > 0)
+    fprintf(out, "[dropped] %lu\n", _profile.dropped);
+
+  if (out != stderr)
+    fclose(out);
+}
+
+static void _initialise_profile(void)
+{
+  if (getenv("MIL_PROFILE") == NULL)
+    return;
+
+  char *interval_setting = getenv("MIL_PROFILE_INTERVAL");
+  long interval = interval_setting == NULL ? 1000 : strtol(interval_setting, NULL, 10);
+
+  if (interval <= 0)
+    interval = 1000;
+
+  _profile.stacks = calloc(PROFILE_STACKS, sizeof(struct ProfileStack));
+  _profile.frames = calloc(PROFILE_FRAMES, sizeof(struct ProfileLocation));
+  if (_profile.stacks == NULL || _profile.frames == NULL)
+  {
+    perror("MIL_PROFILE");
+    exit(1);
+  }
+
+  struct sigaction action;
+  memset(&action, 0, sizeof(action));
+  action.sa_handler = _on_profile_sample;
+  action.sa_flags = SA_RESTART;
+  sigemptyset(&action.sa_mask);
+  sigaction(SIGPROF, &action, NULL);
+
+  struct itimerval timer = {{interval / 1000000, interval % 1000000}, {interval / 1000000, interval % 1000000}};
+  setitimer(ITIMER_PROF, &timer, NULL);
+
+  atexit(_report_profile);
+}
+
+int main(int argc, char *argv[])
+{
+  _initialise_gc();
+
+  _initialise_lib();
+  atexit(_flush_output);
+  _initialise_profile();
 
-  // printf("GC Stats:\n");
-  // printf("  Heap size:                 %lu\n", stats.heapsize_full);
-  // printf("  Free bytes:                %lu\n", stats.free_bytes_full);
-  // printf("  Unmapped bytes:            %lu\n", stats.unmapped_bytes);
-  // printf("  Bytes allocated since GC:  %lu\n", stats.bytes_allocd_since_gc);
-  // printf("  Bytes allocated before GC: %lu\n", stats.allocd_bytes_before_gc);
-  // printf("  Non GC bytes:              %lu\n", stats.non_gc_bytes);
-  // printf("  GC cycle no:               %lu\n", stats.gc_no);
-  // printf("  No of marker threads:      %lu\n", stats.markers_m1);
-  // printf("  Bytes reclaimed since GC:  %lu\n", stats.bytes_reclaimed_since_gc);
-  // printf("  Bytes reclaimed before GC: %lu\n", stats.reclaimed_bytes_before_gc);
-  // printf("  Explicitly freed since GC: %lu\n", stats.expl_freed_bytes_since_gc);
-  // printf("  Memory from OS:            %lu\n", stats.obtained_from_os_bytes);
+  /* An exception that nothing catches exits from _exception_throw */
+  _main(0);
+  _flush_output();
 
+  if (getenv("MIL_PROFILE") != NULL)
+    _report_profile();
+  if (getenv("MIL_GC_STATS") != NULL)
+    _report_gc_stats();
   GC_deinit();
 
-  return result;
+  return 0;
 }
@@ -0,0 +1,739 @@
+/* A generational collector that stands in for bdwgc.  It provides the part
+ * of bdwgc's API used by lib.c and main.c so that the same compiled program
+ * can be linked with nursery.o in place of gc.a - see samples/Makefile.
+ *
+ * Objects are allocated by bumping a pointer through runs of free objects in
+ * blocks holding objects of a single size, and are never moved.  Generations
+ * are kept with sticky mark bits: the mark bit a collection sets stays set,
+ * making the object old, until the next full collection clears every mark.
+ * A minor collection therefore traces only the objects allocated since the
+ * last collection, starting from the roots and from the old objects that
+ * _gc_write_barrier has remembered as having been updated.  Whatever it leaves
+ * unmarked is free and the bump pointer allocates over it.
+ *
+ * Like bdwgc the collector is conservative.  Roots are the native stack, the
+ * registers, the program's data and bss segments and the uncollectable
+ * objects, and objects are scanned a word at a time with any word pointing
+ * into an object keeping it alive.  The runtime is single threaded and so is
+ * the collector.
+ *
+ * MIL_NURSERY_SIZE sets the number of bytes allocated between collections.
+ */
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <setjmp.h>
+#include <sys/mman.h>
+
+#if !defined(__linux__)
+#error "nursery.c finds the program's stack and data segments using symbols only Linux provides"
+#endif
+
+#define HEAP_RESERVE ((uintptr_t)16 << 30)
+#define HEAP_RESERVE_MINIMUM ((uintptr_t)256 << 20)
+
+#define BLOCK_SHIFT 16
+#define BLOCK_SIZE ((uintptr_t)1 << BLOCK_SHIFT)
+#define BITMAP_WORDS ((BLOCK_SIZE / 16) / 64)
+
+#define WORD_SIZE sizeof(uintptr_t)
+#define LARGE_OBJECT_SIZE 4096
+#define NURSERY_SIZE (4 << 20)
+#define FULL_COLLECTION_THRESHOLD (32 << 20)
+
+extern char __data_start[];
+extern char _end[];
+extern void *__libc_stack_end;
+
+enum BlockState
+{
+    BLOCK_FREE,
+    BLOCK_SMALL,
+    BLOCK_LARGE,
+    BLOCK_LARGE_TAIL
+};
+
+/* A small block holds count objects of object_size bytes.  A large object
+ * starts a run of count blocks with the rest of the run marked as tails
+ * pointing back at it.  Mark and remembered bits are indexed by an object's
+ * position in its block.
+ */
+struct Block
+{
+    uint8_t state;
+    uint8_t atomic;
+    uint16_t size_class;
+    uint32_t object_size;
+    uint32_t count;
+    uint32_t head;
+    struct Block *next;
+    uint64_t marks[BITMAP_WORDS];
+    uint64_t remembered[BITMAP_WORDS];
+};
+
+/* Allocation bumps cursor up to limit, the end of a run of free objects in
+ * block.  next is the index of the object following the run and available
+ * the blocks of the same size and kind with free objects still to be used.
+ */
+struct Allocator
+{
+    char *cursor;
+    char *limit;
+    struct Block *block;
+    uint32_t next;
+    struct Block *available;
+};
+
+struct Uncollectable
+{
+    struct Uncollectable *previous;
+    struct Uncollectable *next;
+    size_t size;
+    uintptr_t object[];
+};
+
+/* The values of bdwgc's GC_EventType that are reported.
+ */
+enum
+{
+    GC_EVENT_START = 0,
+    GC_EVENT_END = 5
+};
+
+struct Range
+{
+    char *start;
+    size_t size;
+};
+
+static const uint32_t _class_sizes[] = {
+    16, 24, 32, 40, 48, 56, 64, 80, 96, 112, 128, 160, 192, 224, 256, 320, 384, 448,
+    512, 640, 768, 896, 1024, 1280, 1536, 1792, 2048, 2560, 3072, 3584, 4096};
+
+#define SIZE_CLASSES (sizeof(_class_sizes) / sizeof(_class_sizes[0]))
+
+/* Everything the collector keeps lives in this one struct so that it can be
+ * left out when the data segments are scanned - its pointers into the heap
+ * are not roots.
+ */
+static struct
+{
+    int initialised;
+
+    uintptr_t start;
+    uintptr_t reserved;
+    struct Block *blocks;
+    uint32_t block_count;
+    uint32_t blocks_used;
+    struct Block *free_blocks;
+
+    uint8_t size_class_of[LARGE_OBJECT_SIZE / 8 + 1];
+    struct Allocator allocators[SIZE_CLASSES][2];
+
+    size_t nursery_size;
+    size_t allocated;
+    size_t live;
+    size_t full_threshold;
+    int full_pending;
+
+    struct Range *mark_stack;
+    size_t mark_stack_length;
+    size_t mark_stack_capacity;
+
+    uintptr_t *remembered;
+    size_t remembered_length;
+    size_t remembered_capacity;
+
+    struct Uncollectable *uncollectable;
+
+    size_t minor_collections;
+    size_t full_collections;
+    size_t total_allocated;
+    void (*on_collection_event)(int event);
+} heap;
+
+static void _out_of_memory(void)
+{
+    fprintf(stderr, "Out of memory\n");
+    abort();
+}
+
+static void *_grow(void *items, size_t *capacity, size_t item_size)
+{
+    *capacity = *capacity == 0 ? 1024 : 2 * *capacity;
+    items = realloc(items, *capacity * item_size);
+
+    if (items == NULL)
+        _out_of_memory();
+
+    return items;
+}
+
+static inline struct Block *_block_of(uintptr_t p)
+{
+    return heap.blocks + ((p - heap.start) >> BLOCK_SHIFT);
+}
+
+static inline char *_block_start(struct Block *block)
+{
+    return (char *)(heap.start + ((uintptr_t)(block - heap.blocks) << BLOCK_SHIFT));
+}
+
+static inline int _bit(uint64_t *bitmap, uint32_t index)
+{
+    return (bitmap[index >> 6] >> (index & 63)) & 1;
+}
+
+static inline void _set_bit(uint64_t *bitmap, uint32_t index)
+{
+    bitmap[index >> 6] |= (uint64_t)1 << (index & 63);
+}
+
+static uint32_t _count_bits(uint64_t *bitmap)
+{
+    uint32_t result = 0;
+
+    for (unsigned i = 0; i < BITMAP_WORDS; i += 1)
+        result += __builtin_popcountll(bitmap[i]);
+
+    return result;
+}
+
+/* The block and index of the object that p points into or NULL when p does
+ * not point into an object.
+ */
+static inline struct Block *_object_of(uintptr_t p, uint32_t *index)
+{
+    if (p - heap.start >= (uintptr_t)heap.blocks_used << BLOCK_SHIFT)
+        return NULL;
+
+    struct Block *block = _block_of(p);
+
+    switch (block->state)
+    {
+    case BLOCK_SMALL:
+        *index = (uint32_t)((p - (uintptr_t)_block_start(block)) / block->object_size);
+        return *index < block->count ? block : NULL;
+    case BLOCK_LARGE_TAIL:
+        block = heap.blocks + block->head;
+        /* fall through */
+    case BLOCK_LARGE:
+        *index = 0;
+        return p - (uintptr_t)_block_start(block) < block->object_size ? block : NULL;
+    default:
+        return NULL;
+    }
+}
+
+static inline char *_object_start(struct Block *block, uint32_t index)
+{
+    return _block_start(block) + (uintptr_t)index * (block->state == BLOCK_SMALL ? block->object_size : 0);
+}
+
+static void _mark(uintptr_t p)
+{
+    uint32_t index;
+    struct Block *block = _object_of(p, &index);
+
+    if (block == NULL || _bit(block->marks, index))
+        return;
+
+    _set_bit(block->marks, index);
+
+    if (!block->atomic)
+    {
+        if (heap.mark_stack_length == heap.mark_stack_capacity)
+            heap.mark_stack = _grow(heap.mark_stack, &heap.mark_stack_capacity, sizeof(struct Range));
+        heap.mark_stack[heap.mark_stack_length++] = (struct Range){_object_start(block, index), block->object_size};
+    }
+}
+
+static void _scan(char *start, char *end)
+{
+    uintptr_t *p = (uintptr_t *)(((uintptr_t)start + WORD_SIZE - 1) & ~(WORD_SIZE - 1));
+
+    for (; (char *)(p + 1) <= end; p += 1)
+        _mark(*p);
+}
+
+static void _drain_mark_stack(void)
+{
+    while (heap.mark_stack_length > 0)
+    {
+        struct Range range = heap.mark_stack[--heap.mark_stack_length];
+
+        _scan(range.start, range.start + range.size);
+    }
+}
+
+static void _scan_roots(char *stack_top)
+{
+    _scan(stack_top, (char *)__libc_stack_end);
+
+    char *state = (char *)&heap;
+    _scan(__data_start, state);
+    _scan(state + sizeof(heap), _end);
+
+    for (struct Uncollectable *u = heap.uncollectable; u != NULL; u = u->next)
+        _scan((char *)u->object, (char *)u->object + u->size);
+}
+
+static void _free_block(struct Block *block)
+{
+    block->state = BLOCK_FREE;
+    block->next = heap.free_blocks;
+    heap.free_blocks = block;
+}
+
+/* Small blocks with no marked objects and unmarked large objects return to
+ * the free blocks.  Small blocks with some free objects are handed to their
+ * allocator to be allocated into.
+ */
+static void _sweep(void)
+{
+    heap.free_blocks = NULL;
+    heap.live = 0;
+
+    for (uint32_t i = 0; i < heap.blocks_used; i += 1)
+    {
+        struct Block *block = heap.blocks + i;
+
+        switch (block->state)
+        {
+        case BLOCK_FREE:
+            _free_block(block);
+            break;
+        case BLOCK_SMALL:
+        {
+            uint32_t live = _count_bits(block->marks);
+
+            if (live == 0)
+                _free_block(block);
+            else
+            {
+                heap.live += (size_t)live * block->object_size;
+                if (live < block->count)
+                {
+                    struct Allocator *allocator = &heap.allocators[block->size_class][block->atomic];
+
+                    block->next = allocator->available;
+                    allocator->available = block;
+                }
+            }
+            break;
+        }
+        case BLOCK_LARGE:
+            if (_bit(block->marks, 0))
+            {
+                heap.live += (size_t)block->count * BLOCK_SIZE;
+                i += block->count - 1;
+            }
+            else
+            {
+                uint32_t count = block->count;
+
+                for (uint32_t j = 0; j < count; j += 1)
+                    _free_block(block + j);
+                i += count - 1;
+            }
+            break;
+        }
+    }
+}
+
+/* Scanning the stack from this frame takes in _collect's frame where the
+ * callee-saved registers have been spilled.
+ */
+static void __attribute__((noinline)) _collect_from(int full)
+{
+    char *stack_top = (char *)__builtin_frame_address(0);
+
+    for (unsigned c = 0; c < SIZE_CLASSES; c += 1)
+        for (int atomic = 0; atomic < 2; atomic += 1)
+            heap.allocators[c][atomic] = (struct Allocator){NULL, NULL, NULL, 0, NULL};
+
+    if (full)
+        for (uint32_t i = 0; i < heap.blocks_used; i += 1)
+            memset(heap.blocks[i].marks, 0, sizeof(heap.blocks[i].marks));
+
+    _scan_roots(stack_top);
+    _drain_mark_stack();
+
+    for (size_t i = 0; i < heap.remembered_length; i += 1)
+    {
+        uint32_t index = 0;
+        struct Block *block = _object_of(heap.remembered[i], &index);
+
+        if (!full)
+        {
+            char *start = _object_start(block, index);
+
+            _scan(start, start + block->object_size);
+            _drain_mark_stack();
+        }
+        memset(block->remembered, 0, sizeof(block->remembered));
+    }
+    heap.remembered_length = 0;
+
+    _sweep();
+
+    heap.total_allocated += heap.allocated;
+    heap.allocated = 0;
+    if (full)
+    {
+        heap.full_collections += 1;
+        heap.full_pending = 0;
+        heap.full_threshold = 2 * heap.live > FULL_COLLECTION_THRESHOLD ? 2 * heap.live : FULL_COLLECTION_THRESHOLD;
+    }
+    else
+    {
+        heap.minor_collections += 1;
+        heap.full_pending = heap.live > heap.full_threshold;
+    }
+}
+
+/* Values held only in registers are spilled into this frame, both by
+ * __builtin_unwind_init and into registers, before the stack is scanned.
+ */
+static void __attribute__((noinline)) _collect(int full)
+{
+    jmp_buf registers;
+
+    __builtin_unwind_init();
+    setjmp(registers);
+
+    if (heap.on_collection_event != NULL)
+        heap.on_collection_event(GC_EVENT_START);
+    _collect_from(full || heap.full_pending);
+    if (heap.on_collection_event != NULL)
+        heap.on_collection_event(GC_EVENT_END);
+    __asm__ volatile("" ::"r"(&registers) : "memory");
+}
+
+static struct Block *_take_blocks(uint32_t count)
+{
+    if (count == 1)
+        while (heap.free_blocks != NULL)
+        {
+            struct Block *block = heap.free_blocks;
+
+            heap.free_blocks = block->next;
+            if (block->state == BLOCK_FREE)
+                return block;
+        }
+    else
+        for (uint32_t i = 0, run = 0; i < heap.blocks_used; i += 1)
+        {
+            run = heap.blocks[i].state == BLOCK_FREE ? run + 1 : 0;
+            if (run == count)
+                return heap.blocks + i + 1 - count;
+        }
+
+    if (heap.block_count - heap.blocks_used < count)
+        return NULL;
+
+    struct Block *block = heap.blocks + heap.blocks_used;
+    heap.blocks_used += count;
+
+    return block;
+}
+
+static struct Block *_allocate_blocks(uint32_t count)
+{
+    struct Block *block = _take_blocks(count);
+
+    if (block == NULL)
+    {
+        _collect(1);
+        block = _take_blocks(count);
+        if (block == NULL)
+            _out_of_memory();
+    }
+
+    return block;
+}
+
+/* Finds the next run of unmarked objects for allocator to bump through,
+ * collecting first when the nursery is exhausted.
+ */
+static void _refill(int size_class, int atomic)
+{
+    struct Allocator *allocator = &heap.allocators[size_class][atomic];
+
+    if (heap.allocated >= heap.nursery_size)
+    {
+        _collect(0);
+        allocator = &heap.allocators[size_class][atomic];
+    }
+
+    while (1)
+    {
+        struct Block *block = allocator->block;
+
+        if (block != NULL)
+        {
+            uint32_t index = allocator->next;
+
+            while (index < block->count && _bit(block->marks, index))
+                index += 1;
+
+            uint32_t end = index;
+
+            while (end < block->count && !_bit(block->marks, end))
+                end += 1;
+
+            if (index < end)
+            {
+                allocator->cursor = _block_start(block) + (uintptr_t)index * block->object_size;
+                allocator->limit = _block_start(block) + (uintptr_t)end * block->object_size;
+                allocator->next = end;
+                heap.allocated += (size_t)(end - index) * block->object_size;
+                return;
+            }
+        }
+
+        if (allocator->available != NULL)
+        {
+            block = allocator->available;
+            allocator->available = block->next;
+        }
+        else
+        {
+            block = _allocate_blocks(1);
+            block->state = BLOCK_SMALL;
+            block->atomic = atomic;
+            block->size_class = size_class;
+            block->object_size = _class_sizes[size_class];
+            block->count = BLOCK_SIZE / block->object_size;
+            memset(block->marks, 0, sizeof(block->marks));
+            memset(block->remembered, 0, sizeof(block->remembered));
+        }
+        allocator->block = block;
+        allocator->next = 0;
+    }
+}
+
+static void *_allocate_large(size_t size, int atomic)
+{
+    if (heap.allocated + size >= heap.nursery_size)
+        _collect(0);
+
+    uint32_t count = (uint32_t)((size + BLOCK_SIZE - 1) >> BLOCK_SHIFT);
+    struct Block *block = _allocate_blocks(count);
+
+    block->state = BLOCK_LARGE;
+    block->atomic = atomic;
+    block->object_size = (uint32_t)size;
+    block->count = count;
+    memset(block->marks, 0, sizeof(block->marks));
+    memset(block->remembered, 0, sizeof(block->remembered));
+    for (uint32_t i = 1; i < count; i += 1)
+    {
+        block[i].state = BLOCK_LARGE_TAIL;
+        block[i].head = (uint32_t)(block - heap.blocks);
+    }
+    heap.allocated += size;
+
+    char *result = _block_start(block);
+    if (!atomic)
+        memset(result, 0, size);
+
+    return result;
+}
+
+static inline void *_allocate(size_t size, int atomic)
+{
+    if (size > LARGE_OBJECT_SIZE)
+        return _allocate_large(size, atomic);
+
+    int size_class = heap.size_class_of[(size + 7) >> 3];
+    struct Allocator *allocator = &heap.allocators[size_class][atomic];
+
+    if (allocator->cursor == allocator->limit)
+    {
+        _refill(size_class, atomic);
+        allocator = &heap.allocators[size_class][atomic];
+    }
+
+    char *result = allocator->cursor;
+    allocator->cursor += _class_sizes[size_class];
+
+    if (!atomic)
+        memset(result, 0, _class_sizes[size_class]);
+
+    return result;
+}
+
+void GC_init(void)
+{
+    if (heap.initialised)
+        return;
+
+    uintptr_t reserve = HEAP_RESERVE;
+    void *start = MAP_FAILED;
+    void *blocks = MAP_FAILED;
+
+    for (; reserve >= HEAP_RESERVE_MINIMUM; reserve /= 2)
+    {
+        start = mmap(NULL, reserve + BLOCK_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if (start == MAP_FAILED)
+            continue;
+        blocks = mmap(NULL, (reserve >> BLOCK_SHIFT) * sizeof(struct Block), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if (blocks != MAP_FAILED)
+            break;
+        munmap(start, reserve + BLOCK_SIZE);
+        start = MAP_FAILED;
+    }
+    if (start == MAP_FAILED)
+        _out_of_memory();
+
+    heap.start = ((uintptr_t)start + BLOCK_SIZE - 1) & ~(BLOCK_SIZE - 1);
+    heap.reserved = reserve;
+    heap.blocks = (struct Block *)blocks;
+    heap.block_count = (uint32_t)(reserve >> BLOCK_SHIFT);
+
+    for (uint32_t size = 0, size_class = 0; size <= LARGE_OBJECT_SIZE; size += 8)
+    {
+        while (_class_sizes[size_class] < size)
+            size_class += 1;
+        heap.size_class_of[size >> 3] = (uint8_t)size_class;
+    }
+
+    char *nursery_size = getenv("MIL_NURSERY_SIZE");
+    heap.nursery_size = nursery_size == NULL ? NURSERY_SIZE : strtoul(nursery_size, NULL, 10);
+    if (heap.nursery_size < BLOCK_SIZE)
+        heap.nursery_size = BLOCK_SIZE;
+    heap.full_threshold = FULL_COLLECTION_THRESHOLD;
+
+    heap.initialised = 1;
+}
+
+void GC_deinit(void)
+{
+}
+
+void *GC_malloc(size_t size)
+{
+    return _allocate(size, 0);
+}
+
+void *GC_malloc_atomic(size_t size)
+{
+    return _allocate(size, 1);
+}
+
+void *GC_malloc_uncollectable(size_t size)
+{
+    struct Uncollectable *u = calloc(1, sizeof(struct Uncollectable) + size);
+
+    if (u == NULL)
+        _out_of_memory();
+
+    u->size = size;
+    u->next = heap.uncollectable;
+    if (heap.uncollectable != NULL)
+        heap.uncollectable->previous = u;
+    heap.uncollectable = u;
+
+    return u->object;
+}
+
+/* Only uncollectable objects are freed.  Anything else is left for the next
+ * collection to find.
+ */
+void GC_free(void *p)
+{
+    if (p == NULL || (uintptr_t)p - heap.start < heap.reserved)
+        return;
+
+    struct Uncollectable *u = (struct Uncollectable *)((char *)p - offsetof(struct Uncollectable, object));
+
+    if (u->previous != NULL)
+        u->previous->next = u->next;
+    else
+        heap.uncollectable = u->next;
+    if (u->next != NULL)
+        u->next->previous = u->previous;
+
+    free(u);
+}
+
+void GC_gcollect(void)
+{
+    _collect(1);
+}
+
+/* Minor collections are already short so there is nothing more to do
+ * incrementally.
+ */
+void GC_enable_incremental(void)
+{
+}
+
+/* The heap grows a block at a time as it is needed so expanding it only
+ * touches the blocks' pages up front.
+ */
+int GC_expand_hp(size_t bytes)
+{
+    uint32_t count = (uint32_t)((bytes + BLOCK_SIZE - 1) >> BLOCK_SHIFT);
+
+    if (heap.block_count - heap.blocks_used < count)
+        return 0;
+
+    for (uint32_t i = 0; i < count; i += 1)
+    {
+        struct Block *block = heap.blocks + heap.blocks_used;
+        char *start = _block_start(block);
+
+        for (uintptr_t page = 0; page < BLOCK_SIZE; page += 4096)
+            start[page] = 0;
+        heap.blocks_used += 1;
+        _free_block(block);
+    }
+
+    return 1;
+}
+
+size_t GC_get_heap_size(void)
+{
+    return (size_t)heap.blocks_used << BLOCK_SHIFT;
+}
+
+size_t GC_get_free_bytes(void)
+{
+    return GC_get_heap_size() - heap.live - heap.allocated;
+}
+
+size_t GC_get_total_bytes(void)
+{
+    return heap.total_allocated + heap.allocated;
+}
+
+unsigned long GC_get_gc_no(void)
+{
+    return heap.minor_collections + heap.full_collections;
+}
+
+void GC_set_on_collection_event(void (*on_collection_event)(int event))
+{
+    heap.on_collection_event = on_collection_event;
+}
+
+/* Called after a value is stored into object.  An old object that may now
+ * refer to a young one is remembered so the next minor collection scans it.
+ */
+void _gc_write_barrier(void *object)
+{
+    uint32_t index;
+    struct Block *block = _object_of((uintptr_t)object, &index);
+
+    if (block == NULL || !_bit(block->marks, index) || _bit(block->remembered, index))
+        return;
+
+    _set_bit(block->remembered, index);
+    if (heap.remembered_length == heap.remembered_capacity)
+        heap.remembered = _grow(heap.remembered, &heap.remembered_capacity, sizeof(uintptr_t));
+    heap.remembered[heap.remembered_length++] = (uintptr_t)_object_start(block, index);
+}
@@ -0,0 +1,71 @@
+/* Measures the throughput of printing a list of 10^6 integers through the
+ * buffered output path against printing it with a stdio call per token, as
+ * _print_value used to.  Run with stdout redirected, for example
+ *
+ *     ./printbench > /dev/null
+ *
+ * and the timings are reported on stderr.
+ */
+
+#include <stdio.h>
+#include <time.h>
+
+#include "../../../bdwgc/include/gc.h"
+
+#include "lib.h"
+
+#define LIST_LENGTH 1000000
+
+static double _seconds(void)
+{
+  struct timespec now;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+
+  return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+static void _print_list_stdio(struct Value *list)
+{
+  printf("(");
+  for (struct Value *runner = list; runner != _VNull; runner = AS_PAIR(runner)->cdr)
+  {
+    if (runner != list)
+      printf(" ");
+    printf("%d", INTEGER_OF(AS_PAIR(runner)->car));
+  }
+  printf(")");
+  printf("\n");
+  fflush(stdout);
+}
+
+static void _print_list_buffered(struct Value *list)
+{
+  _print_value("printbench.c", __LINE__, list);
+  _print_newline();
+  _flush_output();
+}
+
+int main(int argc, char *argv[])
+{
+  GC_INIT();
+  _initialise_lib();
+
+  struct Value *list = _VNull;
+  for (int i = LIST_LENGTH; i > 0; i -= 1)
+    list = _mk_pair(_from_literal_int(i), list);
+
+  double start = _seconds();
+  _print_list_stdio(list);
+  double stdio = _seconds() - start;
+
+  start = _seconds();
+  _print_list_buffered(list);
+  double buffered = _seconds() - start;
+
+  fprintf(stderr, "stdio:    %.3fs\n", stdio);
+  fprintf(stderr, "buffered: %.3fs\n", buffered);
+  fprintf(stderr, "speedup:  %.1fx\n", stdio / buffered);
+
+  return 0;
+}
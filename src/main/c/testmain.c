@@ -1,126 +1,41 @@
 #include <stdio.h>
 #include "lib.h"
 
-extern int _main(int n);
+#define VAR_ARG_CLOSURE(procedure, generic) \
+  ((struct Value *)&(struct Closure){CLOSURE_VALUE, -1, (procedure), (generic), NULL})
 
 void run_closure(struct Value *closure)
 {
-  _print_value(closure);
-  _print_newline();
-
-  _print_value(_call_closure_0(
-      closure));
-  _print_newline();
-
-  _print_value(_call_closure_1(
-      closure,
-      _from_literal_int(1)));
-  _print_newline();
-
-  _print_value(_call_closure_2(
-      closure,
-      _from_literal_int(1),
-      _from_literal_int(2)));
-  _print_newline();
-
-  _print_value(_call_closure_3(
-      closure,
-      _from_literal_int(1),
-      _from_literal_int(2),
-      _from_literal_int(3)));
-  _print_newline();
-
-  _print_value(_call_closure_4(
-      closure,
-      _from_literal_int(1),
-      _from_literal_int(2),
-      _from_literal_int(3),
-      _from_literal_int(4)));
-  _print_newline();
-
-  _print_value(_call_closure_5(
-      closure,
-      _from_literal_int(1),
-      _from_literal_int(2),
-      _from_literal_int(3),
-      _from_literal_int(4),
-      _from_literal_int(5)));
-  _print_newline();
-
-  _print_value(_call_closure_6(
-      closure,
-      _from_literal_int(1),
-      _from_literal_int(2),
-      _from_literal_int(3),
-      _from_literal_int(4),
-      _from_literal_int(5),
-      _from_literal_int(6)));
-  _print_newline();
+  struct Value *argv[10];
 
-  _print_value(_call_closure_7(
-      closure,
-      _from_literal_int(1),
-      _from_literal_int(2),
-      _from_literal_int(3),
-      _from_literal_int(4),
-      _from_literal_int(5),
-      _from_literal_int(6),
-      _from_literal_int(7)));
-  _print_newline();
-
-  _print_value(_call_closure_8(
-      closure,
-      _from_literal_int(1),
-      _from_literal_int(2),
-      _from_literal_int(3),
-      _from_literal_int(4),
-      _from_literal_int(5),
-      _from_literal_int(6),
-      _from_literal_int(7),
-      _from_literal_int(8)));
-  _print_newline();
+  for (int i = 0; i < 10; i += 1)
+    argv[i] = _from_literal_int(i + 1);
 
-  _print_value(_call_closure_9(
-      closure,
-      _from_literal_int(1),
-      _from_literal_int(2),
-      _from_literal_int(3),
-      _from_literal_int(4),
-      _from_literal_int(5),
-      _from_literal_int(6),
-      _from_literal_int(7),
-      _from_literal_int(8),
-      _from_literal_int(9)));
+  _print_value("testmain.c", __LINE__, closure);
   _print_newline();
 
-  _print_value(_call_closure_10(
-      closure,
-      _from_literal_int(1),
-      _from_literal_int(2),
-      _from_literal_int(3),
-      _from_literal_int(4),
-      _from_literal_int(5),
-      _from_literal_int(6),
-      _from_literal_int(7),
-      _from_literal_int(8),
-      _from_literal_int(9),
-      _from_literal_int(10)));
-  _print_newline();
+  for (int argc = 0; argc <= 10; argc += 1)
+  {
+    _print_value("testmain.c", __LINE__, _call_closure("testmain.c", __LINE__, closure, argc, argv));
+    _print_newline();
+  }
 }
 
 int main(int argc, char *argv[])
 {
   _initialise_lib();
 
-  struct Value *(*pp)(int, ...) = &_plus_variable;
+  struct Value *arguments[] = {_from_literal_int(10), _from_literal_int(20), _from_literal_int(30)};
 
-  _print_value(pp(3, _from_literal_int(10), _from_literal_int(20), _from_literal_int(30)));
+  _print_value("testmain.c", __LINE__, _plus_variable(3, arguments));
   _print_newline();
 
-  run_closure(_from_native_var_arg_procedure(&_plus_variable));
-  run_closure(_from_native_var_arg_procedure(&_multiply_variable));
-  run_closure(_from_native_var_arg_procedure(&_minus_variable));
-  run_closure(_from_native_var_arg_procedure(&_divide_variable));
-  run_closure(_from_native_var_arg_procedure(&_println));
-  run_closure(_from_native_var_arg_procedure(&_print));
+  run_closure(VAR_ARG_CLOSURE(&_plus_variable, _call_native_var_arg));
+  run_closure(VAR_ARG_CLOSURE(&_multiply_variable, _call_native_var_arg));
+  run_closure(VAR_ARG_CLOSURE(&_minus_variable, _call_native_var_arg));
+  run_closure(VAR_ARG_CLOSURE(&_divide_variable, _call_native_var_arg_position));
+  run_closure(VAR_ARG_CLOSURE(&_println, _call_native_var_arg_position));
+  run_closure(VAR_ARG_CLOSURE(&_print, _call_native_var_arg_position));
+
+  _flush_output();
 }
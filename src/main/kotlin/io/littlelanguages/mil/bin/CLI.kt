@@ -4,10 +4,12 @@ import io.littlelanguages.data.Either
 import io.littlelanguages.data.Left
 import io.littlelanguages.data.Right
 import io.littlelanguages.mil.*
+import io.littlelanguages.mil.compiler.CompileOptions
 import io.littlelanguages.mil.compiler.CompileState
 import io.littlelanguages.mil.compiler.builtinBindings
 import io.littlelanguages.mil.compiler.llvm.Context
 import io.littlelanguages.mil.compiler.llvm.Module
+import io.littlelanguages.mil.compiler.llvm.OptimisationLevel
 import io.littlelanguages.mil.compiler.llvm.targetTriple
 import io.littlelanguages.mil.dynamic.Binding
 import io.littlelanguages.mil.dynamic.translate
@@ -24,17 +26,19 @@ import picocli.CommandLine.Command
 import picocli.CommandLine.Parameters
 import java.io.File
 import java.io.FileReader
+import java.io.IOException
 import java.util.concurrent.Callable
 import kotlin.system.exitProcess
 
-fun compile(builtinBindings: List<Binding<CompileState, LLVMValueRef>>, context: Context, input: File): Either<List<Errors>, Module> {
+fun compile(builtinBindings: List<Binding<CompileState, LLVMValueRef>>, context: Context, input: File, options: CompileOptions = CompileOptions()): Either<List<Errors>, Module> {
     val reader = FileReader(input)
 
     val result = parse(Scanner(reader)) mapLeft { listOf(it) } andThen { translate(builtinBindings, it) } andThen {
         io.littlelanguages.mil.compiler.compile(
             context,
             input.name,
-            it
+            it,
+            options
         )
     }
     reader.close()
@@ -118,41 +122,145 @@ fun formatError(error: Errors): String =
             "Unknown Symbol: ${formatLocation(error.location)}: Reference to unknown symbol \"${error.name}\""
     }
 
-fun compile(input: File, triple: String, output: File) {
+// Compiles input and passes the module to write, which returns the error should writing fail.
+fun compile(input: File, triple: String, options: CompileOptions = CompileOptions(), write: (Module) -> String?) {
     val context = Context(triple)
 
-    when (val compiledResult = compile(builtinBindings, context, input)) {
+    when (val compiledResult = compile(builtinBindings, context, input, options)) {
         is Left -> {
             reportErrors(compiledResult.left)
             exitProcess(1)
         }
-        is Right ->
-            compiledResult.right.writeBitcodeToFile(output.absolutePath)
+        is Right -> {
+            val error = write(compiledResult.right)
+
+            if (error != null) {
+                reportErrors(listOf(CompilationError(error)))
+                exitProcess(1)
+            }
+        }
     }
     context.dispose()
 }
 
+// Links objectFile and then libraries, in order, into the executable output with linker, a C compiler driver such as cc,
+// and returns the error should it fail.
+fun link(linker: String, objectFile: File, libraries: List<File>, output: File): String? {
+    val command = listOf(linker, objectFile.absolutePath) + libraries.map { it.absolutePath } + listOf("-o", output.absolutePath)
+
+    return try {
+        val exitCode = ProcessBuilder(command).inheritIO().start().waitFor()
+
+        if (exitCode == 0) null else "${command.joinToString(" ")}: exited with $exitCode"
+    } catch (e: IOException) {
+        "$linker: ${e.message}"
+    }
+}
+
 @Command(name = "ll-mini-ilisp-kotlin-llvm", version = ["0.1"], mixinStandardHelpOptions = true, description = ["A mini iLisp compiler."])
 class CLI : Callable<Int> {
     @Parameters(paramLabel = "FILE", description = ["File to compile.  File must exist and have a .mlsp extension."], arity = "1")
     private lateinit var file: File
 
+    @CommandLine.Option(names = ["-o"], paramLabel = "FILE", description = ["File to write to.  Defaults to the input file with the extension of what is emitted: .bc, .o or, for an executable, none."])
+    private var output: File? = null
+
+    @CommandLine.Option(names = ["--emit"], paramLabel = "KIND", description = ["What to write: bitcode, object or executable.  Defaults to bitcode."])
+    private var emit = "bitcode"
+
+    @CommandLine.Option(names = ["-l", "--library"], paramLabel = "FILE", description = ["Archive or object file that an executable is linked with, in the order given.  For example libmil.a and then gc.a."])
+    private var libraries = mutableListOf<File>()
+
+    @CommandLine.Option(names = ["--linker"], paramLabel = "CC", description = ["C compiler driver that links an executable.  Defaults to cc."])
+    private var linker = "cc"
+
     @CommandLine.Option(names = ["-t", "--triple"], paramLabel = "TRIPLE", description = ["Module target triple embedded into the compiled code."])
     private var triple = targetTriple()
 
-    private fun failOnError(error: String) {
+    @CommandLine.Option(names = ["--flat-closures"], description = ["Pass nested procedures an environment of captured values rather than their parent's frame."])
+    private var flatClosures = false
+
+    @CommandLine.Option(names = ["-O"], paramLabel = "LEVEL", description = ["Optimisation level: 0, 1, 2, 3 or s.  Defaults to 2."])
+    private var optimisation = "2"
+
+    @CommandLine.Option(names = ["--target-cpu"], paramLabel = "CPU", description = ["CPU the compiled code may use the instructions of, or native for the CPU compiling it.  Defaults to any CPU of the target triple."])
+    private var targetCPU: String? = null
+
+    @CommandLine.Option(names = ["--runtime"], paramLabel = "FILE", description = ["Link the runtime's bitcode, lib.bc, into the compiled code so that the runtime can be inlined.  The program is then linked without lib.o."])
+    private var runtime: File? = null
+
+    @CommandLine.Option(names = ["--profile"], description = ["Keep a shadow stack of the procedures being run so that running with MIL_PROFILE set samples where time is spent."])
+    private var profile = false
+
+    @CommandLine.Option(names = ["--profile-allocations"], description = ["Record the line of each call so that running with MIL_ALLOCATION_PROFILE set reports the values allocated by each line."])
+    private var profileAllocations = false
+
+    private fun failOnError(error: String): Nothing {
         println("Error: $error")
         exitProcess(1)
     }
 
     override fun call(): Int {
-        // Take file and compile with defaults to a .bc file.  File must have a .mlsp extension and the extension is changed to a .o
+        // Take file and compile it to the bitcode, object or executable named by -o.  File must have a .mlsp extension which,
+        // without -o, is changed to .bc, .o or, for an executable, removed.
         if (!file.canRead())
             failOnError("Invalid input file: $file is not readable")
         if (file.extension != "mlsp")
             failOnError("Invalid input file: $file requires a .mlsp extension")
 
-        compile(file, triple, changeExtension(file, ".bc"))
+        val optimisationLevel = when (optimisation) {
+            "0" -> OptimisationLevel.O0
+            "1" -> OptimisationLevel.O1
+            "2" -> OptimisationLevel.O2
+            "3" -> OptimisationLevel.O3
+            "s" -> OptimisationLevel.Os
+            else -> null
+        }
+        if (runtime?.canRead() == false)
+            failOnError("Invalid runtime: $runtime is not readable")
+        libraries.filter { !it.canRead() }.forEach { failOnError("Invalid library: $it is not readable") }
+        if (emit != "bitcode" && emit != "object" && emit != "executable")
+            failOnError("Invalid emit: $emit must be one of bitcode, object or executable")
+        if (optimisationLevel == null)
+            failOnError("Invalid optimisation level: $optimisation must be one of 0, 1, 2, 3 or s")
+
+        val outputFile = output ?: when (emit) {
+            "bitcode" -> changeExtension(file, ".bc")
+            "object" -> changeExtension(file, ".o")
+            else -> changeExtension(file, "")
+        }
+
+        compile(
+            file,
+            triple,
+            CompileOptions(
+                flatClosures = flatClosures,
+                profile = profile,
+                profileAllocations = profileAllocations,
+                optimisation = optimisationLevel,
+                targetCPU = targetCPU,
+                runtime = runtime?.absolutePath
+            )
+        ) { module ->
+            when (emit) {
+                "bitcode" -> {
+                    module.writeBitcodeToFile(outputFile.absolutePath)
+                    null
+                }
+                "object" ->
+                    module.writeObjectToFile(outputFile.absolutePath, optimisationLevel, targetCPU)
+                else -> {
+                    val objectFile = File.createTempFile("mil", ".o")
+
+                    try {
+                        module.writeObjectToFile(objectFile.absolutePath, optimisationLevel, targetCPU)
+                            ?: link(linker, objectFile, libraries, outputFile)
+                    } finally {
+                        objectFile.delete()
+                    }
+                }
+            }
+        }
 
         return 0
     }
@@ -1,40 +1,84 @@
 package io.littlelanguages.mil.compiler
 
 import io.littlelanguages.data.Either
+import io.littlelanguages.data.Left
 import io.littlelanguages.data.Right
 import io.littlelanguages.mil.CompilationError
 import io.littlelanguages.mil.Errors
 import io.littlelanguages.mil.compiler.llvm.Context
 import io.littlelanguages.mil.compiler.llvm.FunctionBuilder
 import io.littlelanguages.mil.compiler.llvm.Module
+import io.littlelanguages.mil.compiler.llvm.OptimisationLevel
 import io.littlelanguages.mil.compiler.llvm.VerifyError
 import io.littlelanguages.mil.dynamic.*
 import io.littlelanguages.mil.dynamic.tst.*
 import org.bytedeco.javacpp.PointerPointer
+import org.bytedeco.llvm.LLVM.LLVMBasicBlockRef
 import org.bytedeco.llvm.LLVM.LLVMValueRef
 import org.bytedeco.llvm.global.LLVM
 
-data class CompileState(val compiler: Compiler, val functionBuilder: FunctionBuilder, val depth: Int)
+data class CompileState(
+    val compiler: Compiler,
+    val functionBuilder: FunctionBuilder,
+    val depth: Int,
+    val parameters: List<LLVMValueRef> = emptyList(),
+    val environment: List<Binding<CompileState, LLVMValueRef>> = emptyList(),
+    val loop: SelfTailLoop? = null
+)
+
+// A procedure that calls itself in tail position is compiled as a loop.  Its parameters are phis in the loop's header
+// block and a self tail call branches back to the header passing its arguments into these phis.
+class SelfTailLoop(val procedureName: String, val header: LLVMBasicBlockRef, val parameters: List<LLVMValueRef>)
+
+data class CompileOptions(
+    // Pass nested procedures an environment of the values they capture rather than a chain of frames
+    val flatClosures: Boolean = false,
+
+    // Keep a shadow stack of the procedures being run for the sampling profiler in main.c
+    val profile: Boolean = false,
 
-fun compile(context: Context, moduleID: String, program: Program<CompileState, LLVMValueRef>): Either<List<Errors>, Module> {
+    // Record the position of each call as the site of the values it allocates for the allocation profiler in lib.c
+    val profileAllocations: Boolean = false,
+
+    val optimisation: OptimisationLevel = OptimisationLevel.O2,
+
+    // The cpu the compiled code is for, "native" for the cpu compiling it, or null for any cpu of the target triple
+    val targetCPU: String? = null,
+
+    // The runtime's bitcode, linked into the module before it is optimised, or null to link the program with lib.o
+    val runtime: String? = null
+)
+
+fun compile(context: Context, moduleID: String, program: Program<CompileState, LLVMValueRef>, options: CompileOptions = CompileOptions()): Either<List<Errors>, Module> {
     val module = context.module(moduleID)
 
-    Compiler(module).compile(program)
+    Compiler(module, options).compile(program)
+
+    // The runtime is linked in before the module is optimised so that its procedures can be inlined
+    if (options.runtime != null) {
+        val linkError = module.linkBitcode(options.runtime)
+
+        if (linkError != null)
+            return Left(listOf(CompilationError(linkError)))
+    }
 
-    val pm = LLVM.LLVMCreatePassManager()
-    LLVM.LLVMAddAggressiveInstCombinerPass(pm)
-    LLVM.LLVMAddNewGVNPass(pm)
-    LLVM.LLVMAddCFGSimplificationPass(pm)
-    LLVM.LLVMRunPassManager(pm, module.module)
+    val error = module.optimise(options.optimisation, options.targetCPU)
 
-    return Right(module)
+    return if (error == null) Right(module) else Left(listOf(CompilationError(error)))
 }
 
-class Compiler(private val module: Module) {
+class Compiler(private val module: Module, private val options: CompileOptions) {
+    var flatClosures: FlatClosures<CompileState, LLVMValueRef>? = null
+
     fun compile(program: Program<CompileState, LLVMValueRef>) {
+        if (options.flatClosures)
+            flatClosures = FlatClosures(program)
+
         val procedures = declareProcedures(program.declarations)
 
         module.addGlobalString(module.moduleID, "_filename")
+        module.addFunctionHeader("_initialise_symbols", emptyList(), module.void)
+        LLVM.LLVMSetLinkage(module.getNamedFunction("_initialise_symbols"), LLVM.LLVMInternalLinkage)
 
         program.values.forEach {
             module.addGlobal(it, module.structValueP, LLVM.LLVMConstPointerNull(module.structValueP), false)
@@ -44,6 +88,8 @@ class Compiler(private val module: Module) {
             compile(declaration)
         }
 
+        compileSymbolInitialisation()
+
 //        System.err.println(module.toString())
 
         when (val result = module.verify()) {
@@ -66,35 +112,96 @@ class Compiler(private val module: Module) {
 
     private fun compileMainProcedure(declaration: Procedure<CompileState, LLVMValueRef>) {
         val builder = module.addFunctionBody(declaration.name)
-        compileProcedureBody(builder, declaration)
+        builder.buildCall(builder.getNamedFunction("_initialise_symbols")!!, emptyList())
+        compileProcedureBody(builder, declaration, false)
 
         builder.buildRet(LLVM.LLVMConstInt(module.i32, 0, 0))
     }
 
+    // Literal symbols are interned once, before _main runs any of the module's code, so that each use is a load.
+    private fun compileSymbolInitialisation() {
+        val builder = module.addFunctionBody("_initialise_symbols")
+
+        module.literalSymbols().forEach { (name, symbol) ->
+            builder.buildStore(builder.buildInternSymbol(builder.buildFromLiteralString(name)), symbol)
+        }
+        builder.buildRetVoid()
+    }
+
     private fun compileProcedure(declaration: Procedure<CompileState, LLVMValueRef>) {
         val builder = module.addFunctionBody(declaration.name)
-        val result = compileProcedureBody(builder, declaration)
+        val result = compileProcedureBody(builder, declaration, true)
 
         builder.buildRet(result ?: builder.buildVNull())
     }
 
-    private fun compileProcedureBody(functionBuilder: FunctionBuilder, declaration: Procedure<CompileState, LLVMValueRef>): LLVMValueRef? {
-        val frame = functionBuilder.buildMkFrame(
-            if (declaration.isTopLevel()) functionBuilder.buildVNull() else functionBuilder.getParam(0),
-            declaration.offsets,
-            "_frame"
-        )
+    private fun compileProcedureBody(functionBuilder: FunctionBuilder, declaration: Procedure<CompileState, LLVMValueRef>, returnsValue: Boolean): LLVMValueRef? {
+        val flatClosures = flatClosures
+        // A nested procedure is passed its parent's frame, or with flat closures its environment, after its arguments
+        val parentFrame = if (declaration.isTopLevel()) functionBuilder.buildVNull() else functionBuilder.getParam(declaration.parameters.size)
+        val arguments = List(declaration.parameters.size) { functionBuilder.getParam(it) }
+
+        if (options.profile)
+            functionBuilder.buildProfileEnter(declaration.name)
+        if (options.profileAllocations)
+            functionBuilder.enableAllocationSites(getFileName(functionBuilder))
+
+        // The loop header comes before the frame so that each iteration starts with a freshly initialised frame
+        val loop =
+            if (returnsValue && hasSelfTailCall(declaration)) {
+                val entry = functionBuilder.getCurrentBasicBlock()
+                val header = functionBuilder.appendBasicBlock("loop")
+
+                functionBuilder.buildBr(header)
+                functionBuilder.positionAtEnd(header)
+
+                SelfTailLoop(
+                    declaration.name,
+                    header,
+                    arguments.map { functionBuilder.buildPhi(functionBuilder.structValueP, listOf(it), listOf(entry)) })
+            } else
+                null
+        val parameters = loop?.parameters ?: arguments
+
+        // With flat closures a frame only holds the procedure's own values as closures copy what they capture
+        val allocation =
+            if (flatClosures == null)
+                frameAllocation(declaration)
+            else if (declaration.offsets > declaration.parameters.size)
+                FrameAllocation.STACK
+            else
+                FrameAllocation.NONE
+
+        val frame = when (allocation) {
+            FrameAllocation.NONE -> null
+            FrameAllocation.STACK -> functionBuilder.buildStackFrame(parentFrame, declaration.offsets, "_frame")
+            FrameAllocation.HEAP -> functionBuilder.buildMkFrame(parentFrame, declaration.offsets, "_frame")
+        }
+
+        // Parameters are only read through the frame by nested procedures
+        val copyParameters = flatClosures == null && hasNestedProcedure(declaration)
 
         declaration.parameters.forEachIndexed { index, name ->
-            val op = functionBuilder.getParam(index + if (declaration.isTopLevel()) 0 else 1)
-            functionBuilder.buildSetFrameValue(frame, index + 1, op)
+            val op = parameters[index]
+            if (copyParameters)
+                functionBuilder.buildSetFrameValue(frame!!, index + 1, op, false)
             functionBuilder.addBindingToScope(name, op)
         }
-        functionBuilder.addBindingToScope("_frame", frame)
+        if (frame != null)
+            functionBuilder.addBindingToScope("_frame", frame)
+
+        val compileState = CompileState(
+            this,
+            functionBuilder,
+            declaration.depth,
+            parameters,
+            flatClosures?.freeVariables(declaration.name) ?: emptyList(),
+            loop
+        )
 
         functionBuilder.openScope()
-        val result = declaration.es.fold(null as LLVMValueRef?) { _, b: Expression<CompileState, LLVMValueRef> ->
-            compileExpression(CompileState(this, functionBuilder, declaration.depth), b)
+        val result = declaration.es.foldIndexed(null as LLVMValueRef?) { index, _, b: Expression<CompileState, LLVMValueRef> ->
+            compileExpression(compileState, b, returnsValue && index == declaration.es.size - 1)
         }
         functionBuilder.closeScope()
 
@@ -142,6 +249,9 @@ private class DeclareProcedures(private val module: Module) {
                 addFunctionsFromExpressions(e.e3)
             }
 
+            is TryExpression ->
+                addFunctionsFromExpressions(e.body)
+
             is Procedure ->
                 addFunction(e)
         }
@@ -172,8 +282,8 @@ private class DeclareProcedures(private val module: Module) {
 private fun <S, T> Procedure<S, T>.isTopLevel(): Boolean =
     this.depth == 0
 
-private fun compileExpression(compileState: CompileState, e: Expression<CompileState, LLVMValueRef>): LLVMValueRef? =
-    CompileExpression(compileState).compileExpression(e)
+private fun compileExpression(compileState: CompileState, e: Expression<CompileState, LLVMValueRef>, tail: Boolean = false): LLVMValueRef? =
+    CompileExpression(compileState).compileExpression(e, tail)
 
 private fun compileScopedExpressionsForce(compileState: CompileState, es: Expressions<CompileState, LLVMValueRef>): LLVMValueRef =
     CompileExpression(compileState).compileScopedExpressionsForce(es)
@@ -181,16 +291,16 @@ private fun compileScopedExpressionsForce(compileState: CompileState, es: Expres
 private class CompileExpression(val compileState: CompileState) {
     val functionBuilder = compileState.functionBuilder
 
-    fun compileScopedExpressionsForce(es: Expressions<CompileState, LLVMValueRef>): LLVMValueRef {
+    fun compileScopedExpressionsForce(es: Expressions<CompileState, LLVMValueRef>, tail: Boolean = false): LLVMValueRef {
         functionBuilder.openScope()
-        val op = compileExpressionsForce(es)
+        val op = compileExpressionsForce(es, tail)
         functionBuilder.closeScope()
         return op
     }
 
-    fun compileExpressionsForce(es: Expressions<CompileState, LLVMValueRef>): LLVMValueRef =
-        es.fold(null as LLVMValueRef?) { _, b: Expression<CompileState, LLVMValueRef> ->
-            compileExpression(b)
+    fun compileExpressionsForce(es: Expressions<CompileState, LLVMValueRef>, tail: Boolean = false): LLVMValueRef =
+        es.foldIndexed(null as LLVMValueRef?) { index, _, b: Expression<CompileState, LLVMValueRef> ->
+            compileExpression(b, tail && index == es.size - 1)
         } ?: functionBuilder.buildVNull()
 
     fun compileScopedExpressionForce(e: Expression<CompileState, LLVMValueRef>): LLVMValueRef {
@@ -203,17 +313,29 @@ private class CompileExpression(val compileState: CompileState) {
     fun compileExpressionForce(e: Expression<CompileState, LLVMValueRef>): LLVMValueRef =
         compileExpression(e) ?: functionBuilder.buildVNull()
 
-    fun compileExpression(e: Expression<CompileState, LLVMValueRef>): LLVMValueRef? =
+    // An expression in tail position produces the value of the procedure being compiled.  Calls in tail position return
+    // directly so that they do not grow the native stack.
+    fun compileExpression(e: Expression<CompileState, LLVMValueRef>, tail: Boolean = false): LLVMValueRef? =
         when (e) {
             is AssignExpression -> {
                 val symbol = e.symbol
+                val box =
+                    if (isBoxed(symbol)) {
+                        val box = functionBuilder.buildMkEnvironment(listOf(functionBuilder.buildVNull()))
+                        functionBuilder.buildSetFrameValue(functionBuilder.getBindingValue("_frame")!!, (symbol as ProcedureValueBinding).offset + 1, box)
+                        box
+                    } else
+                        null
                 val operand = compileScopedExpressionsForce(e.es)
                 when (symbol) {
                     is TopLevelValueBinding ->
                         functionBuilder.buildStore(operand, functionBuilder.getNamedGlobal(symbol.name)!!)
 
                     is ProcedureValueBinding ->
-                        functionBuilder.buildSetFrameValue(functionBuilder.getBindingValue("_frame")!!, symbol.offset + 1, operand)
+                        if (box == null)
+                            functionBuilder.buildSetFrameValue(functionBuilder.getBindingValue("_frame")!!, symbol.offset + 1, operand)
+                        else
+                            functionBuilder.buildSetFrameValue(box, 0, operand)
 
                     else ->
                         TODO(e.toString())
@@ -225,15 +347,29 @@ private class CompileExpression(val compileState: CompileState) {
 
             is CallProcedureExpression ->
                 when (val procedure = e.procedure) {
-                    is ExternalProcedureBinding ->
+                    is ExternalProcedureBinding -> {
+                        functionBuilder.buildSourceLine(e.lineNumber)
                         procedure.compile(compileState, e.lineNumber, e.es)
+                    }
 
                     is DeclaredProcedureBinding -> {
                         val functionRef = functionBuilder.getNamedFunction(procedure.name)!!
                         val arguments = e.es.map { compileExpressionsForce(it) }
-                        val fullArguments = if (procedure.isToplevel()) arguments else listOf(getFrame(procedure.depth)) + arguments
-
-                        functionBuilder.buildCall(functionRef, fullArguments)
+                        val loop = compileState.loop
+
+                        if (tail && loop != null && loop.procedureName == procedure.name)
+                            functionBuilder.buildLoopBack(loop.header, loop.parameters, arguments)
+                        else {
+                            val fullArguments = if (procedure.isToplevel()) arguments else arguments + getFrame(procedure, false)
+                            functionBuilder.buildSourceLine(e.lineNumber)
+                            val result = functionBuilder.buildCall(functionRef, fullArguments)
+
+                            // A callee passed this procedure's stack frame or environment needs this procedure's stack
+                            if (tail && fullArguments.none { functionBuilder.isStackAllocated(it) })
+                                functionBuilder.buildTailCallReturn(result)
+                            else
+                                result
+                        }
                     }
 
                     else ->
@@ -244,7 +380,8 @@ private class CompileExpression(val compileState: CompileState) {
                 val op = compileScopedExpressionsForce(e.operand)
                 val es = e.es.map { compileScopedExpressionForce(it) }
 
-                functionBuilder.buildCallClosure(getFileName(functionBuilder), e.lineNumber, op, es)
+                functionBuilder.buildSourceLine(e.lineNumber)
+                functionBuilder.buildCallClosure(getFileName(functionBuilder), e.lineNumber, op, es, tail)
             }
 
             is IfExpression -> {
@@ -260,12 +397,12 @@ private class CompileExpression(val compileState: CompileState) {
                 functionBuilder.buildCondBr(e1Compare, ifThen, ifElse)
 
                 functionBuilder.positionAtEnd(ifThen)
-                val e2op = compileScopedExpressionsForce(e.e2)
+                val e2op = compileScopedExpressionsForce(e.e2, tail)
                 functionBuilder.buildBr(ifEnd)
                 val fromThen = functionBuilder.getCurrentBasicBlock()
 
                 functionBuilder.positionAtEnd(ifElse)
-                val e3op = compileScopedExpressionsForce(e.e3)
+                val e3op = compileScopedExpressionsForce(e.e3, tail)
                 functionBuilder.buildBr(ifEnd)
                 val fromElse = functionBuilder.getCurrentBasicBlock()
 
@@ -280,6 +417,9 @@ private class CompileExpression(val compileState: CompileState) {
             is LiteralString ->
                 functionBuilder.buildFromLiteralString(e.value)
 
+            is LiteralSymbol ->
+                functionBuilder.buildFromLiteralSymbol(e.name)
+
             is LiteralUnit ->
                 functionBuilder.buildVNull()
 
@@ -294,10 +434,12 @@ private class CompileExpression(val compileState: CompileState) {
                         when (symbol) {
                             is ParameterBinding ->
                                 if (compileState.depth == symbol.depth)
-                                    functionBuilder.getParam(symbol.offset + if (compileState.depth == 0) 0 else 1)
+                                    compileState.parameters[symbol.offset]
+                                else if (compileState.compiler.flatClosures != null)
+                                    getEnvironmentValue(symbol)
                                 else if (compileState.depth > symbol.depth)
                                     functionBuilder.buildGetFrameValue(
-                                        functionBuilder.getParam(0),
+                                        getParentFrame(),
                                         compileState.depth - symbol.depth - 1,
                                         symbol.offset + 1
                                     )
@@ -305,44 +447,41 @@ private class CompileExpression(val compileState: CompileState) {
                                     TODO("depth mismatch")
 
                             is FixedArityExternalProcedure ->
-                                functionBuilder.buildFromNativeProcedure(
-                                    getFileName(functionBuilder),
-                                    e.lineNumber,
-                                    symbol.externalName,
-                                    symbol.arity
-                                )
+                                functionBuilder.buildFromNativeProcedure(symbol.externalName, symbol.arity)
 
                             is ExternalValueBinding ->
                                 symbol.compile(compileState)!!
 
                             is ProcedureValueBinding ->
                                 if (compileState.depth == symbol.depth)
-                                    functionBuilder.buildGetFrameValue(
-                                        functionBuilder.getBindingValue("_frame")!!,
-                                        0,
-                                        symbol.offset + 1
+                                    unbox(
+                                        symbol,
+                                        functionBuilder.buildGetFrameValue(
+                                            functionBuilder.getBindingValue("_frame")!!,
+                                            0,
+                                            symbol.offset + 1
+                                        )
                                     )
+                                else if (compileState.compiler.flatClosures != null)
+                                    getEnvironmentValue(symbol)
                                 else
                                     functionBuilder.buildGetFrameValue(
-                                        functionBuilder.getParam(0),
+                                        getParentFrame(),
                                         compileState.depth - symbol.depth - 1,
                                         symbol.offset + 1
                                     )
 
                             is DeclaredProcedureBinding ->
                                 if (symbol.depth == 0)
-                                    functionBuilder.buildFromNativeProcedure(
-                                        getFileName(functionBuilder),
-                                        e.lineNumber,
-                                        symbol.name,
-                                        symbol.parameterCount
-                                    )
-                                else
+                                    functionBuilder.buildFromNativeProcedure(symbol.name, symbol.parameterCount)
+                                else {
+                                    functionBuilder.buildSourceLine(e.lineNumber)
                                     functionBuilder.buildFromDynamicProcedure(
                                         symbol.name,
                                         symbol.parameterCount,
-                                        getFrame(symbol.depth)
+                                        getFrame(symbol, true)
                                     )
+                                }
 
                             is TopLevelValueBinding ->
                                 functionBuilder.buildLoad(functionBuilder.getNamedGlobal(symbol.name)!!)
@@ -351,11 +490,7 @@ private class CompileExpression(val compileState: CompileState) {
                                 functionBuilder.buildFromNativeVarArgProcedure(symbol.externalName)
 
                             is VariableArityExternalPositionProcedure ->
-                                functionBuilder.buildFromNativeVarArgPositionProcedure(
-                                    getFileName(functionBuilder),
-                                    e.lineNumber,
-                                    symbol.externalName
-                                )
+                                functionBuilder.buildFromNativeVarArgPositionProcedure(symbol.externalName)
 
                             else ->
                                 TODO(e.toString())
@@ -378,27 +513,101 @@ private class CompileExpression(val compileState: CompileState) {
                 null
             }
 
-            is TryExpression ->
-                functionBuilder.buildExceptionTry(
-                    getFileName(functionBuilder),
-                    e.lineNumber,
-                    compileExpressionForce(e.body),
-                    compileExpressionForce(e.catch)
-                )
+            is TryExpression -> {
+                val landingPad = functionBuilder.appendBasicBlock("catch")
+                val tryEnd = functionBuilder.appendBasicBlock()
+
+                functionBuilder.enterTry(landingPad)
+                val bodyOp = compileScopedExpressionsForce(e.body)
+                functionBuilder.leaveTry()
+                functionBuilder.buildBr(tryEnd)
+                val fromBody = functionBuilder.getCurrentBasicBlock()
+
+                val exception = functionBuilder.buildCatch(landingPad)
+                val handler = e.catch.symbol
+                functionBuilder.buildSourceLine(e.lineNumber)
+                val catchOp =
+                    if (callsHandlerDirectly(e) && handler is DeclaredProcedureBinding)
+                        functionBuilder.buildCall(
+                            functionBuilder.getNamedFunction(handler.name)!!,
+                            if (handler.isToplevel()) listOf(exception) else listOf(exception, getFrame(handler, false))
+                        )
+                    else
+                        functionBuilder.buildCallClosure(getFileName(functionBuilder), e.lineNumber, compileScopedExpressionForce(e.catch), listOf(exception))
+                functionBuilder.buildBr(tryEnd)
+                val fromCatch = functionBuilder.getCurrentBasicBlock()
+
+                functionBuilder.positionAtEnd(tryEnd)
+
+                functionBuilder.buildPhi(functionBuilder.structValueP, listOf(bodyOp, catchOp), listOf(fromBody, fromCatch))
+            }
 
             else ->
                 TODO(e.toString())
         }
 
+    // The frame, or with flat closures the environment, passed to a nested procedure.  An environment that outlives
+    // the call is allocated on the heap.
+    private fun getFrame(procedure: DeclaredProcedureBinding<CompileState, LLVMValueRef>, escapes: Boolean): LLVMValueRef {
+        val flatClosures = compileState.compiler.flatClosures ?: return getFrame(procedure.depth)
+        val freeVariables = flatClosures.freeVariables(procedure.name)
+
+        return when {
+            freeVariables.isEmpty() ->
+                functionBuilder.buildVNull()
+
+            !escapes && freeVariables == compileState.environment ->
+                getParentFrame()
+
+            else -> {
+                val values = freeVariables.map { capturedValue(it) }
+
+                if (escapes)
+                    functionBuilder.buildMkEnvironment(values)
+                else
+                    functionBuilder.buildStackEnvironment(values)
+            }
+        }
+    }
+
+    // The value stored into an environment for a captured variable.  Boxed values are captured as their box.
+    private fun capturedValue(binding: Binding<CompileState, LLVMValueRef>): LLVMValueRef =
+        when {
+            binding is ParameterBinding && binding.depth == compileState.depth ->
+                compileState.parameters[binding.offset]
+
+            binding is ProcedureValueBinding && binding.depth == compileState.depth ->
+                functionBuilder.buildGetFrameValue(functionBuilder.getBindingValue("_frame")!!, 0, binding.offset + 1)
+
+            else ->
+                functionBuilder.buildGetFrameValue(getParentFrame(), 0, compileState.environment.indexOf(binding))
+        }
+
+    private fun getEnvironmentValue(binding: Binding<CompileState, LLVMValueRef>): LLVMValueRef =
+        unbox(binding, functionBuilder.buildGetFrameValue(getParentFrame(), 0, compileState.environment.indexOf(binding)))
+
+    private fun unbox(binding: Binding<CompileState, LLVMValueRef>, value: LLVMValueRef): LLVMValueRef =
+        if (isBoxed(binding))
+            functionBuilder.buildGetFrameValue(value, 0, 0)
+        else
+            value
+
+    private fun isBoxed(binding: Binding<CompileState, LLVMValueRef>): Boolean =
+        compileState.compiler.flatClosures?.isBoxed(binding) ?: false
+
+    // The frame or environment passed to this procedure by its caller.
+    private fun getParentFrame(): LLVMValueRef =
+        functionBuilder.getParam(compileState.parameters.size)
+
     private fun getFrame(depth: Int): LLVMValueRef =
         if (compileState.depth == depth)
-            functionBuilder.getParam(0)
+            getParentFrame()
         else if (compileState.depth < depth)
             functionBuilder.getBindingValue("_frame")!!
         else
             functionBuilder.buildGetFrameValue(
-                functionBuilder.getBindingValue("_frame")!!,
-                compileState.depth - depth,
+                getParentFrame(),
+                compileState.depth - depth - 1,
                 0
             )
 }
@@ -411,44 +620,108 @@ private fun getFileName(functionBuilder: FunctionBuilder): LLVMValueRef =
     )
 
 val builtinBindings = listOf(
-    VariableArityExternalProcedure("+", "_plus_variable"),
-    VariableArityExternalProcedure("-", "_minus_variable"),
-    VariableArityExternalProcedure("*", "_multiply_variable"),
-    VariableArityExternalPositionProcedure("/", "_divide_variable"),
-    FixedArityExternalProcedure("=", 2, "_equals"),
-    FixedArityExternalProcedure("<", 2, "_less_than"),
+    IntegerArithmeticProcedure("+", "_plus_variable", "_plus", LLVM.LLVMAdd, 0, false),
+    IntegerArithmeticProcedure("-", "_minus_variable", "_minus", LLVM.LLVMSub, 0, true),
+    IntegerArithmeticProcedure("*", "_multiply_variable", "_multiply", LLVM.LLVMMul, 1, false),
+    DivideProcedure(),
+    EqualsProcedure(),
+    LessThanProcedure(),
     FixedArityExternalProcedure("boolean?", 1, "_booleanp"),
     FixedArityExternalPositionProcedure("car", 1, "_pair_car"),
     FixedArityExternalPositionProcedure("cdr", 1, "_pair_cdr"),
     FixedArityExternalProcedure("integer?", 1, "_integerp"),
     FixedArityExternalProcedure("null?", 1, "_nullp"),
-    FixedArityExternalProcedure("pair", 2, "_mk_pair"),
+    PairExternalProcedure(),
     VariableArityExternalPositionProcedure("print", "_print"),
     VariableArityExternalPositionProcedure("println", "_println"),
     FixedArityExternalProcedure("string?", 1, "_stringp"),
     FixedArityExternalProcedure("pair?", 1, "_pairp"),
     FixedArityExternalPositionProcedure("exit", 1, "_fail"),
+    VariableArityExternalProcedure("vector", "_vector"),
+    FixedArityExternalProcedure("vector?", 1, "_vectorp"),
+    FixedArityExternalPositionProcedure("vector-length", 1, "_vector_length"),
+    FixedArityExternalPositionProcedure("vector-ref", 2, "_vector_ref"),
+    FixedArityExternalPositionProcedure("vector-set", 3, "_vector_set"),
+    FixedArityExternalPositionProcedure("vector-slice", 3, "_vector_slice"),
+    FixedArityExternalPositionProcedure("vector->list", 1, "_vector_to_list"),
+    FixedArityExternalPositionProcedure("list->vector", 1, "_list_to_vector"),
+    VariableArityExternalPositionProcedure("int32-array", "_int32_array"),
+    FixedArityExternalProcedure("int32-array?", 1, "_int32_arrayp"),
+    FixedArityExternalPositionProcedure("int32-array-range", 2, "_int32_array_range"),
+    FixedArityExternalPositionProcedure("int32-array-length", 1, "_int32_array_length"),
+    FixedArityExternalPositionProcedure("int32-array-ref", 2, "_int32_array_ref"),
+    FixedArityExternalPositionProcedure("vector->int32-array", 1, "_vector_to_int32_array"),
+    FixedArityExternalPositionProcedure("int32-array->vector", 1, "_int32_array_to_vector"),
+    FixedArityExternalPositionProcedure("int32-array-sum", 1, "_int32_array_sum"),
+    FixedArityExternalPositionProcedure("int32-array-min", 1, "_int32_array_min"),
+    FixedArityExternalPositionProcedure("int32-array-max", 1, "_int32_array_max"),
+    FixedArityExternalPositionProcedure("int32-array-dot", 2, "_int32_array_dot"),
+    FixedArityExternalPositionProcedure("int32-array-add", 2, "_int32_array_add"),
+    FixedArityExternalPositionProcedure("int32-array-multiply", 2, "_int32_array_multiply"),
+    FixedArityExternalPositionProcedure("int32-array-prefix-sum", 1, "_int32_array_prefix_sum"),
+    VariableArityExternalPositionProcedure("map-of", "_map_of"),
+    FixedArityExternalProcedure("map?", 1, "_mapp"),
+    FixedArityExternalPositionProcedure("map-size", 1, "_map_size"),
+    FixedArityExternalPositionProcedure("map-get", 2, "_map_get"),
+    FixedArityExternalPositionProcedure("map-contains?", 2, "_map_containsp"),
+    FixedArityExternalPositionProcedure("map-put", 3, "_map_put"),
+    FixedArityExternalPositionProcedure("map-remove", 2, "_map_remove"),
+    FixedArityExternalPositionProcedure("list->map", 1, "_list_to_map"),
+    FixedArityExternalPositionProcedure("map->list", 1, "_map_to_list"),
+    FixedArityExternalPositionProcedure("map-keys", 1, "_map_keys"),
+    FixedArityExternalProcedure("symbol?", 1, "_symbolp"),
+    FixedArityExternalPositionProcedure("symbol->string", 1, "_symbol_to_string"),
+    FixedArityExternalPositionProcedure("string->symbol", 1, "_string_to_symbol"),
 
     VFalseExternalValue(),
     VTrueExternalValue(),
     VNullExternalValue(),
 )
 
-private class FixedArityExternalProcedure(
+private open class FixedArityExternalProcedure(
     override val name: String,
     override val arity: Int,
     val externalName: String
 ) : ExternalProcedureBinding<CompileState, LLVMValueRef>(name, arity) {
-    override fun compile(state: CompileState, lineNumber: Int, arguments: Expressionss<CompileState, LLVMValueRef>): LLVMValueRef {
-        val builder = state.functionBuilder
+    override fun compile(state: CompileState, lineNumber: Int, arguments: Expressionss<CompileState, LLVMValueRef>): LLVMValueRef =
+        compileCall(state.functionBuilder, arguments.map { compileScopedExpressionsForce(state, it) })
 
+    fun compileCall(builder: FunctionBuilder, operands: List<LLVMValueRef>): LLVMValueRef {
         val namedFunction = builder.getNamedFunction(
             externalName,
-            List(arguments.size) { builder.structValueP },
+            List(operands.size) { builder.structValueP },
             builder.structValueP
         )
 
-        return builder.buildCall(namedFunction, arguments.map { compileScopedExpressionsForce(state, it) })
+        return builder.buildCall(namedFunction, operands)
+    }
+}
+
+// Immediates are equal only when their words are equal so _equals is needed only when both operands are heap values.
+private class EqualsProcedure : FixedArityExternalProcedure("=", 2, "_equals") {
+    override fun compile(state: CompileState, lineNumber: Int, arguments: Expressionss<CompileState, LLVMValueRef>): LLVMValueRef {
+        val builder = state.functionBuilder
+        val (op1, op2) = arguments.map { compileScopedExpressionsForce(state, it) }
+
+        return builder.buildFastPath(
+            builder.buildIsEitherImmediate(op1, op2),
+            { builder.buildFromBoolean(builder.buildICmp(LLVM.LLVMIntEQ, op1, op2)) },
+            { compileCall(builder, listOf(op1, op2)) }
+        )
+    }
+}
+
+// Integer immediates share their tag bits so comparing the words orders them as their integer values.
+private class LessThanProcedure : FixedArityExternalProcedure("<", 2, "_less_than") {
+    override fun compile(state: CompileState, lineNumber: Int, arguments: Expressionss<CompileState, LLVMValueRef>): LLVMValueRef {
+        val builder = state.functionBuilder
+        val (op1, op2) = arguments.map { compileScopedExpressionsForce(state, it) }
+
+        return builder.buildFastPath(
+            builder.buildIsIntegers(op1, op2),
+            { builder.buildFromBoolean(builder.buildICmp(LLVM.LLVMIntSLT, builder.buildWord(op1), builder.buildWord(op2))) },
+            { compileCall(builder, listOf(op1, op2)) }
+        )
     }
 }
 
@@ -475,38 +748,117 @@ private class FixedArityExternalPositionProcedure(
     }
 }
 
-private class VariableArityExternalProcedure(
+private class PairExternalProcedure : ExternalProcedureBinding<CompileState, LLVMValueRef>("pair", 2) {
+    override fun compile(state: CompileState, lineNumber: Int, arguments: Expressionss<CompileState, LLVMValueRef>): LLVMValueRef {
+        val builder = state.functionBuilder
+
+        val car = compileScopedExpressionsForce(state, arguments[0])
+        val cdr = compileScopedExpressionsForce(state, arguments[1])
+
+        return if (LLVM.LLVMIsConstant(car) == 1 && LLVM.LLVMIsConstant(cdr) == 1)
+            builder.buildLiteralPair(car, cdr)
+        else
+            builder.buildCall(
+                builder.getNamedFunction("_mk_pair", List(2) { builder.structValueP }, builder.structValueP),
+                listOf(car, cdr)
+            )
+    }
+}
+
+private open class VariableArityExternalProcedure(
     override val name: String,
     val externalName: String
 ) : ExternalProcedureBinding<CompileState, LLVMValueRef>(name, null) {
+    override fun compile(state: CompileState, lineNumber: Int, arguments: Expressionss<CompileState, LLVMValueRef>): LLVMValueRef =
+        compileCall(state.functionBuilder, arguments.map { compileScopedExpressionsForce(state, it) })
+
+    fun compileCall(builder: FunctionBuilder, operands: List<LLVMValueRef>): LLVMValueRef =
+        builder.buildCall(
+            builder.getNamedFunction(externalName, listOf(builder.i32, builder.structValuePP), builder.structValueP),
+            listOf(LLVM.LLVMConstInt(builder.i32, operands.size.toLong(), 0), builder.buildArgumentVector(operands))
+        )
+}
+
+// A call's arity is known so it is compiled as a left fold of binary applications, each computed inline with 32-bit
+// wrapping, as lib.c does, when both operands are integers.  The variadic runtime procedure is only used when the
+// procedure is called through a value.  With negates a single operand is combined with unit, as (- x) is (- 0 x).
+private class IntegerArithmeticProcedure(
+    name: String,
+    externalName: String,
+    val binaryName: String,
+    val opcode: Int,
+    val unit: Int,
+    val negates: Boolean
+) : VariableArityExternalProcedure(name, externalName) {
     override fun compile(state: CompileState, lineNumber: Int, arguments: Expressionss<CompileState, LLVMValueRef>): LLVMValueRef {
         val builder = state.functionBuilder
+        val operands = arguments.map { compileScopedExpressionsForce(state, it) }
 
-        return builder.buildCall(
-            builder.getNamedFunction(externalName, listOf(builder.i32), builder.structValueP, true),
-            listOf(LLVM.LLVMConstInt(builder.i32, arguments.size.toLong(), 0)) + arguments.map { compileScopedExpressionsForce(state, it) }
-        )
+        return when {
+            operands.isEmpty() ->
+                builder.buildFromLiteralInt(unit)
+
+            operands.size == 1 && negates ->
+                compileBinary(builder, builder.buildFromLiteralInt(unit), operands[0])
+
+            else ->
+                operands.drop(1).fold(operands[0]) { op1, op2 -> compileBinary(builder, op1, op2) }
+        }
     }
+
+    private fun compileBinary(builder: FunctionBuilder, op1: LLVMValueRef, op2: LLVMValueRef): LLVMValueRef =
+        builder.buildFastPath(
+            builder.buildIsIntegers(op1, op2),
+            { builder.buildFromInteger(builder.buildBinOp(opcode, builder.buildIntegerOf(op1), builder.buildIntegerOf(op2))) },
+            {
+                builder.buildCall(
+                    builder.getNamedFunction(binaryName, List(2) { builder.structValueP }, builder.structValueP),
+                    listOf(op1, op2)
+                )
+            }
+        )
 }
 
-private class VariableArityExternalPositionProcedure(
+private open class VariableArityExternalPositionProcedure(
     override val name: String,
     val externalName: String
 ) : ExternalProcedureBinding<CompileState, LLVMValueRef>(name, null) {
     override fun compile(state: CompileState, lineNumber: Int, arguments: Expressionss<CompileState, LLVMValueRef>): LLVMValueRef {
         val builder = state.functionBuilder
+        val operands = arguments.map { compileScopedExpressionsForce(state, it) }
 
         return builder.buildCall(
-            builder.getNamedFunction(externalName, listOf(builder.i8P, builder.i32, builder.i32), builder.structValueP, true),
+            builder.getNamedFunction(externalName, listOf(builder.i8P, builder.i32, builder.i32, builder.structValuePP), builder.structValueP),
             listOf(
                 getFileName(builder),
                 LLVM.LLVMConstInt(builder.i32, lineNumber.toLong(), 0),
-                LLVM.LLVMConstInt(builder.i32, arguments.size.toLong(), 0)
-            ) + arguments.map { compileScopedExpressionsForce(state, it) }
+                LLVM.LLVMConstInt(builder.i32, operands.size.toLong(), 0),
+                builder.buildArgumentVector(operands)
+            )
         )
     }
 }
 
+// Division is a left fold of calls to _divide, which reports division by zero at the position of the call.
+private class DivideProcedure : VariableArityExternalPositionProcedure("/", "_divide_variable") {
+    override fun compile(state: CompileState, lineNumber: Int, arguments: Expressionss<CompileState, LLVMValueRef>): LLVMValueRef {
+        val builder = state.functionBuilder
+        val operands = arguments.map { compileScopedExpressionsForce(state, it) }
+
+        fun divide(op1: LLVMValueRef, op2: LLVMValueRef): LLVMValueRef =
+            builder.buildCall(
+                builder.getNamedFunction("_divide", listOf(builder.i8P, builder.i32, builder.structValueP, builder.structValueP), builder.structValueP),
+                listOf(getFileName(builder), LLVM.LLVMConstInt(builder.i32, lineNumber.toLong(), 0), op1, op2)
+            )
+
+        return when (operands.size) {
+            0 -> builder.buildFromLiteralInt(1)
+            1 -> divide(builder.buildFromLiteralInt(1), operands[0])
+            else -> operands.drop(1).fold(operands[0]) { op1, op2 -> divide(op1, op2) }
+        }
+    }
+}
+
 private class VFalseExternalValue : ExternalValueBinding<CompileState, LLVMValueRef>("#f") {
     override fun compile(state: CompileState, lineNumber: Int): LLVMValueRef =
         state.functionBuilder.buildVFalse()
@@ -1,9 +1,29 @@
 package io.littlelanguages.mil.compiler.llvm
 
+import org.bytedeco.javacpp.BytePointer
 import org.bytedeco.javacpp.PointerPointer
 import org.bytedeco.llvm.LLVM.LLVMContextRef
+import org.bytedeco.llvm.LLVM.LLVMTargetMachineRef
+import org.bytedeco.llvm.LLVM.LLVMTargetRef
+import org.bytedeco.llvm.LLVM.LLVMValueRef
 import org.bytedeco.llvm.global.LLVM
 
+// Immediate value encoding - must agree with the IMMEDIATE_* definitions in lib.h
+const val IMMEDIATE_BITS = 3
+const val IMMEDIATE_MASK = 7L
+const val POINTER_IMMEDIATE = 0L
+const val INTEGER_IMMEDIATE = 1L
+const val CONSTANT_IMMEDIATE = 3L
+
+// Heap value tags - must agree with the *_VALUE definitions in lib.h
+const val STRING_VALUE = 3L
+const val PAIR_VALUE = 4L
+const val VECTOR_VALUE = 5L
+const val CLOSURE_VALUE = 6L
+const val FRAME_VALUE = 8L
+const val INT32_ARRAY_VALUE = 9L
+const val HASHMAP_VALUE = 10L
+
 class Context(val triple: String) {
     init {
         LLVM.LLVMInitializeCore(LLVM.LLVMGetGlobalPassRegistry())
@@ -24,28 +44,30 @@ class Context(val triple: String) {
     val structValue = LLVM.LLVMStructCreateNamed(context, "struct.Value")!!
     val structValueP = LLVM.LLVMPointerType(structValue, 0)!!
     val structValuePP = LLVM.LLVMPointerType(structValueP, 0)!!
-    val unionAnon = LLVM.LLVMStructCreateNamed(context, "union.anon")!!
     val structPair = LLVM.LLVMStructCreateNamed(context, "struct.Pair")!!
     val structVector = LLVM.LLVMStructCreateNamed(context, "struct.Vector")!!
-    val structNativeClosure = LLVM.LLVMStructCreateNamed(context, "struct.NativeClosure")!!
-    val structDynamicClosure = LLVM.LLVMStructCreateNamed(context, "struct.DynamicClosure")!!
+    val structClosure = LLVM.LLVMStructCreateNamed(context, "struct.Closure")!!
+    val structProfileFrame = LLVM.LLVMStructCreateNamed(context, "struct.ProfileFrame")!!
 
     val c0i64 = LLVM.LLVMConstInt(i64, 0, 0)!!
 
+    val cVNull = constImmediate(0, CONSTANT_IMMEDIATE)
+    val cVFalse = constImmediate(1, CONSTANT_IMMEDIATE)
+    val cVTrue = constImmediate(2, CONSTANT_IMMEDIATE)
+
+    fun constInteger(n: Int): LLVMValueRef =
+        constImmediate(n.toLong(), INTEGER_IMMEDIATE)
+
+    private fun constImmediate(value: Long, tag: Long): LLVMValueRef =
+        LLVM.LLVMConstIntToPtr(LLVM.LLVMConstInt(i64, (value shl IMMEDIATE_BITS) or tag, 1), structValueP)!!
+
+    // Heap value layouts - must agree with the struct definitions in lib.h
     init {
         LLVM.LLVMStructSetBody(
             structValue,
             PointerPointer(
-                i32,
-                unionAnon
+                i32
             ),
-            2,
-            0
-        )
-
-        LLVM.LLVMStructSetBody(
-            unionAnon,
-            structNativeClosure,
             1,
             0
         )
@@ -53,10 +75,11 @@ class Context(val triple: String) {
         LLVM.LLVMStructSetBody(
             structPair,
             PointerPointer(
-                structValue,
-                structValue
+                i32,
+                structValueP,
+                structValueP
             ),
-            2,
+            3,
             0
         )
 
@@ -64,29 +87,32 @@ class Context(val triple: String) {
             structVector,
             PointerPointer(
                 i32,
-                structValuePP
+                i32,
+                LLVM.LLVMArrayType(structValueP, 0)
             ),
-            2,
+            3,
             0
         )
 
         LLVM.LLVMStructSetBody(
-            structNativeClosure,
+            structClosure,
             PointerPointer(
-                i8P,
                 i32,
-                i8P
+                i32,
+                i8P,
+                i8P,
+                structValueP
             ),
-            3,
+            5,
             0
         )
 
         LLVM.LLVMStructSetBody(
-            structDynamicClosure,
+            structProfileFrame,
             PointerPointer(
                 i8P,
-                i32,
-                structValueP
+                i8P,
+                i32
             ),
             3,
             0
@@ -99,6 +125,32 @@ class Context(val triple: String) {
 
     fun module(moduleID: String) =
         Module(moduleID, this)
+
+    // A machine generating code for this context's triple on cpu with features.  The caller disposes of it.
+    fun targetMachine(cpu: String, features: String, codeGenLevel: Int): LLVMTargetMachineRef {
+        val target = LLVMTargetRef()
+        val error = BytePointer()
+
+        if (LLVM.LLVMGetTargetFromTriple(triple, target, error) != 0) {
+            val message = error.string
+            LLVM.LLVMDisposeMessage(error)
+            throw IllegalArgumentException(message)
+        }
+
+        return LLVM.LLVMCreateTargetMachine(target, triple, cpu, features, codeGenLevel, LLVM.LLVMRelocPIC, LLVM.LLVMCodeModelDefault)
+    }
+}
+
+// The name and features of the cpu this compiler is running on.
+fun hostCPU(): Pair<String, String> {
+    val name = LLVM.LLVMGetHostCPUName()
+    val features = LLVM.LLVMGetHostCPUFeatures()
+    val result = Pair(name.string, features.string)
+
+    LLVM.LLVMDisposeMessage(name)
+    LLVM.LLVMDisposeMessage(features)
+
+    return result
 }
 
 fun targetTriple(): String {
@@ -11,41 +11,142 @@ import org.bytedeco.llvm.global.LLVM
 class FunctionBuilder(private val context: Context, private val module: Module, private val builder: LLVMBuilderRef, var procedure: LLVMValueRef) {
     private var currentBasicBlock: LLVMBasicBlockRef = appendBasicBlock("entry")
     private var bindings = NestedMap<Any, LLVMValueRef>()
+    private val landingPads = mutableListOf<LLVMBasicBlockRef>()
+    private var profileFrame: LLVMValueRef? = null
+    private var allocationFileName: LLVMValueRef? = null
 
     init {
         positionAtEnd(currentBasicBlock)
     }
 
+    fun buildBinOp(opcode: Int, lhs: LLVMValueRef, rhs: LLVMValueRef, name: String = ""): LLVMValueRef =
+        LLVM.LLVMBuildBinOp(builder, opcode, lhs, rhs, name)
+
     fun buildBr(basicBlock: LLVMBasicBlockRef): LLVMValueRef =
         LLVM.LLVMBuildBr(builder, basicBlock)
 
-    fun buildCall(functionRef: LLVMValueRef, arguments: List<LLVMValueRef?>, name: String = ""): LLVMValueRef =
-        LLVM.LLVMBuildCall(
-            builder,
-            functionRef,
-            pointerPointerOf(arguments),
-            arguments.size,
-            name
-        )
+    // Within a try every call is an invoke that unwinds to the try's landing pad.
+    fun buildCall(functionRef: LLVMValueRef, arguments: List<LLVMValueRef?>, name: String = ""): LLVMValueRef {
+        val landingPad = landingPads.lastOrNull()
+
+        return if (landingPad == null)
+            LLVM.LLVMBuildCall(
+                builder,
+                functionRef,
+                pointerPointerOf(arguments),
+                arguments.size,
+                name
+            )
+        else {
+            val normal = appendBasicBlock()
+            val result = LLVM.LLVMBuildInvoke(
+                builder,
+                functionRef,
+                pointerPointerOf(arguments),
+                arguments.size,
+                normal,
+                landingPad,
+                name
+            )
+
+            positionAtEnd(normal)
+            result
+        }
+    }
 
+    // A closure whose arity matches the call is entered directly with the arguments followed by its frame.  Anything
+    // else - a value that is not a closure, an arity mismatch or a native taking a variable number of arguments - is
+    // passed to _call_closure with the arguments in an argv array.  When tail is set each call's result is returned
+    // straight away and anything built after this is unreachable.
     fun buildCallClosure(
         fileName: LLVMValueRef,
         lineNumber: Int,
         closureRef: LLVMValueRef,
-        arguments: List<LLVMValueRef?>,
+        arguments: List<LLVMValueRef>,
+        tail: Boolean = false,
         name: String = ""
     ): LLVMValueRef {
         val numberOfArguments = arguments.size
+        val closure = LLVM.LLVMBuildBitCast(builder, closureRef, LLVM.LLVMPointerType(context.structClosure, 0), "")
+        val closureBlock = appendBasicBlock("closure")
+        val fastBlock = appendBasicBlock("fast")
+        val slowBlock = appendBasicBlock("slow")
+
+        buildCondBr(
+            buildICmp(
+                LLVM.LLVMIntEQ,
+                buildBinOp(LLVM.LLVMAnd, buildWord(closureRef), LLVM.LLVMConstInt(i64, IMMEDIATE_MASK, 0)),
+                context.c0i64
+            ),
+            closureBlock,
+            slowBlock
+        )
 
-        return buildCall(
-            getNamedFunction("_call_closure_$numberOfArguments", listOf(i8P, i32) + List(1 + numberOfArguments) { structValueP }, structValueP),
+        positionAtEnd(closureBlock)
+        val isClosure = buildICmp(
+            LLVM.LLVMIntEQ,
+            buildLoad(LLVM.LLVMBuildStructGEP(builder, closure, 0, "")),
+            LLVM.LLVMConstInt(i32, CLOSURE_VALUE, 0)
+        )
+        val isArity = buildICmp(
+            LLVM.LLVMIntEQ,
+            buildLoad(LLVM.LLVMBuildStructGEP(builder, closure, 1, "")),
+            LLVM.LLVMConstInt(i32, numberOfArguments.toLong(), 0)
+        )
+        buildCondBr(buildBinOp(LLVM.LLVMAnd, isClosure, isArity), fastBlock, slowBlock)
+
+        positionAtEnd(fastBlock)
+        val entryType = LLVM.LLVMFunctionType(structValueP, pointerPointerOf(List(numberOfArguments + 1) { structValueP }), numberOfArguments + 1, 0)
+        val entry = LLVM.LLVMBuildBitCast(
+            builder,
+            buildLoad(LLVM.LLVMBuildStructGEP(builder, closure, 2, "")),
+            LLVM.LLVMPointerType(entryType, 0),
+            ""
+        )
+        val fastOp = buildCall(entry, arguments + buildLoad(LLVM.LLVMBuildStructGEP(builder, closure, 4, "")))
+        val fromFast = finishClosureCall(fastOp, tail)
+
+        positionAtEnd(slowBlock)
+        val slowOp = buildCall(
+            getNamedFunction("_call_closure", listOf(i8P, i32, structValueP, i32, structValuePP), structValueP),
             listOf(
                 fileName,
                 LLVM.LLVMConstInt(i32, lineNumber.toLong(), 0),
-                closureRef
-            ) + arguments,
-            name
+                closureRef,
+                LLVM.LLVMConstInt(i32, numberOfArguments.toLong(), 0),
+                buildArgumentVector(arguments)
+            )
         )
+        // The argument vector lives in this procedure's stack so the slow path is returned from without a tail call
+        val fromSlow = finishClosureCall(slowOp, tail, numberOfArguments == 0)
+
+        return if (tail) {
+            positionAtEnd(appendBasicBlock())
+            context.cVNull
+        } else {
+            val endBlock = appendBasicBlock()
+
+            positionAtEnd(fromFast)
+            buildBr(endBlock)
+            positionAtEnd(fromSlow)
+            buildBr(endBlock)
+            positionAtEnd(endBlock)
+
+            buildPhi(structValueP, listOf(fastOp, slowOp), listOf(fromFast, fromSlow), name)
+        }
+    }
+
+    private fun finishClosureCall(call: LLVMValueRef, tail: Boolean, tailCall: Boolean = true): LLVMBasicBlockRef {
+        if (tail) {
+            if (tailCall) {
+                LLVM.LLVMSetTailCall(call, 1)
+                buildProfileLeaveBefore(call)
+                LLVM.LLVMBuildRet(builder, call)
+            } else
+                buildRet(call)
+        }
+
+        return currentBasicBlock
     }
 
     fun buildCondBr(ifOp: LLVMValueRef, thenOp: LLVMBasicBlockRef, elseOp: LLVMBasicBlockRef): LLVMValueRef =
@@ -68,29 +169,43 @@ class FunctionBuilder(private val context: Context, private val module: Module,
         )
     }
 
-    fun buildExceptionTry(
-        fileName: LLVMValueRef,
-        lineNumber: Int,
-        tryProc: LLVMValueRef,
-        catchProc: LLVMValueRef,
-        name: String = ""
-    ): LLVMValueRef =
-        buildCall(
-            getNamedFunction("_exception_try", listOf(i8P, i32, structValueP, structValueP), structValueP),
-            listOf(
-                fileName,
-                LLVM.LLVMConstInt(i32, lineNumber.toLong(), 0),
-                tryProc,
-                catchProc
-            ),
+    // Calls built between enterTry and leaveTry unwind to landingPad.  Tries nest so the innermost landing pad is used.
+    fun enterTry(landingPad: LLVMBasicBlockRef) {
+        landingPads.add(landingPad)
+    }
+
+    fun leaveTry() {
+        landingPads.removeLast()
+    }
+
+    // Starts landingPad, which catches every exception raised by _exception_throw, and returns the exception's value.
+    fun buildCatch(landingPad: LLVMBasicBlockRef, name: String = ""): LLVMValueRef {
+        val personality = getNamedFunction("_exception_personality", emptyList(), i32, true)
+        LLVM.LLVMSetPersonalityFn(procedure, personality)
+
+        positionAtEnd(landingPad)
+
+        val landingPadType = LLVM.LLVMStructTypeInContext(context.context, PointerPointer(i8P, i32), 2, 0)
+        val caught = LLVM.LLVMBuildLandingPad(builder, landingPadType, personality, 1, "")
+        LLVM.LLVMAddClause(caught, LLVM.LLVMConstNull(i8P))
+
+        // Unwinding has left the frames of the procedures that were unwound on the shadow stack
+        val frame = profileFrame
+        if (frame != null)
+            buildVolatileStore(LLVM.LLVMBuildBitCast(builder, frame, i8P, ""), module.getRuntimeGlobal("_profile_top", i8P))
+
+        return buildCall(
+            getNamedFunction("_exception_catch", listOf(i8P), structValueP),
+            listOf(LLVM.LLVMBuildExtractValue(builder, caught, 0, "")),
             name
         )
+    }
 
     fun buildFromDynamicProcedure(functionName: String, numberOfArguments: Int, frameRef: LLVMValueRef, name: String = ""): LLVMValueRef =
         buildCall(
             getNamedFunction("_from_dynamic_procedure", listOf(i8P, i32, structValueP), structValueP),
             listOf(
-                LLVM.LLVMConstBitCast(getNamedFunction(functionName, List(numberOfArguments) { structValueP }, structValueP), i8P),
+                LLVM.LLVMConstBitCast(getNamedFunction(functionName, List(numberOfArguments + 1) { structValueP }, structValueP), i8P),
                 LLVM.LLVMConstInt(i32, numberOfArguments.toLong(), 0),
                 frameRef
             ),
@@ -98,60 +213,161 @@ class FunctionBuilder(private val context: Context, private val module: Module,
         )
 
     fun buildFromLiteralInt(n: Int): LLVMValueRef =
-        buildCall(
-            getNamedFunction("_from_literal_int", listOf(i32), structValueP),
-            listOf(LLVM.LLVMConstInt(i32, n.toLong(), 0)),
-        )
+        context.constInteger(n)
 
-    fun buildFromNativeProcedure(
-        fileName: LLVMValueRef,
-        lineNumber: Int,
-        functionName: String,
-        numberOfArguments: Int,
-        name: String = ""
-    ): LLVMValueRef =
-        buildCall(
-            getNamedFunction("_from_native_procedure", listOf(i8P, i32, i8P, i32), structValueP),
-            listOf(
-                fileName,
-                LLVM.LLVMConstInt(i32, lineNumber.toLong(), 0),
-                LLVM.LLVMConstBitCast(getNamedFunction(functionName, List(numberOfArguments) { structValueP }, structValueP), i8P),
-                LLVM.LLVMConstInt(i32, numberOfArguments.toLong(), 0)
+    // Converts an i1 into #t or #f.
+    fun buildFromBoolean(v: LLVMValueRef, name: String = ""): LLVMValueRef =
+        LLVM.LLVMBuildSelect(builder, v, context.cVTrue, context.cVFalse, name)
+
+    // Converts an i32 into an integer immediate.
+    fun buildFromInteger(v: LLVMValueRef, name: String = ""): LLVMValueRef =
+        LLVM.LLVMBuildIntToPtr(
+            builder,
+            buildBinOp(
+                LLVM.LLVMOr,
+                buildBinOp(LLVM.LLVMShl, LLVM.LLVMBuildSExt(builder, v, i64, ""), LLVM.LLVMConstInt(i64, IMMEDIATE_BITS.toLong(), 0)),
+                LLVM.LLVMConstInt(i64, INTEGER_IMMEDIATE, 0)
             ),
+            structValueP,
             name
         )
 
-    fun buildFromNativeVarArgProcedure(functionName: String, name: String = ""): LLVMValueRef =
-        buildCall(
-            getNamedFunction("_from_native_var_arg_procedure", listOf(i8P), structValueP),
-            listOf(
-                LLVM.LLVMConstBitCast(getNamedFunction(functionName, listOf(i32), structValueP, true), i8P)
-            ),
+    // Extracts the i32 held in an integer immediate.
+    fun buildIntegerOf(v: LLVMValueRef, name: String = ""): LLVMValueRef =
+        LLVM.LLVMBuildTrunc(
+            builder,
+            LLVM.LLVMBuildAShr(builder, buildWord(v), LLVM.LLVMConstInt(i64, IMMEDIATE_BITS.toLong(), 0), ""),
+            i32,
             name
         )
 
-    fun buildFromNativeVarArgPositionProcedure(fileName: LLVMValueRef, lineNumber: Int, functionName: String, name: String = ""): LLVMValueRef =
-        buildCall(
-            getNamedFunction("_from_native_var_arg_position_procedure", listOf(i8P, i32, i8P), structValueP),
-            listOf(
-                fileName,
-                LLVM.LLVMConstInt(i32, lineNumber.toLong(), 0),
-                LLVM.LLVMConstBitCast(getNamedFunction(functionName, listOf(i32), structValueP, true), i8P)
+    fun buildWord(v: LLVMValueRef, name: String = ""): LLVMValueRef =
+        LLVM.LLVMBuildPtrToInt(builder, v, i64, name)
+
+    // An i1 that is true when both values are integer immediates.
+    fun buildIsIntegers(op1: LLVMValueRef, op2: LLVMValueRef): LLVMValueRef {
+        val integerTag = LLVM.LLVMConstInt(i64, INTEGER_IMMEDIATE, 0)
+
+        return buildICmp(
+            LLVM.LLVMIntEQ,
+            buildBinOp(
+                LLVM.LLVMAnd,
+                buildBinOp(
+                    LLVM.LLVMOr,
+                    buildBinOp(LLVM.LLVMXor, buildWord(op1), integerTag),
+                    buildBinOp(LLVM.LLVMXor, buildWord(op2), integerTag)
+                ),
+                LLVM.LLVMConstInt(i64, IMMEDIATE_MASK, 0)
             ),
-            name
+            context.c0i64
         )
+    }
 
-    fun buildFromLiteralString(s: String): LLVMValueRef =
-        buildCall(
-            getNamedFunction("_from_literal_string", listOf(i8P), structValueP),
-            listOf(LLVM.LLVMConstInBoundsGEP(addGlobalString(s), PointerPointer(c0i64, c0i64), 2))
+    // An i1 that is true when at least one of the values is an immediate rather than a heap pointer.
+    fun buildIsEitherImmediate(op1: LLVMValueRef, op2: LLVMValueRef): LLVMValueRef =
+        buildICmp(
+            LLVM.LLVMIntNE,
+            buildBinOp(
+                LLVM.LLVMAnd,
+                buildBinOp(LLVM.LLVMOr, buildWord(op1), buildWord(op2)),
+                LLVM.LLVMConstInt(i64, IMMEDIATE_MASK, 0)
+            ),
+            context.c0i64
         )
 
-    fun buildGetFrameValue(frame: LLVMValueRef, relativeDepth: Int, index: Int, name: String = ""): LLVMValueRef =
-        buildCall(
-            getNamedFunction("_get_frame_value", listOf(structValueP, i32, i32), structValueP),
-            listOf(frame, LLVM.LLVMConstInt(i32, relativeDepth.toLong(), 0), LLVM.LLVMConstInt(i32, index.toLong(), 0)),
-            name
+    // Evaluates fast when condition holds and slow otherwise, merging their results.  Used to inline the common case of
+    // a runtime procedure while leaving everything else to lib.c.
+    fun buildFastPath(condition: LLVMValueRef, fast: () -> LLVMValueRef, slow: () -> LLVMValueRef): LLVMValueRef {
+        val fastBlock = appendBasicBlock("fast")
+        val slowBlock = appendBasicBlock("slow")
+        val endBlock = appendBasicBlock()
+
+        buildCondBr(condition, fastBlock, slowBlock)
+
+        positionAtEnd(fastBlock)
+        val fastOp = fast()
+        buildBr(endBlock)
+        val fromFast = getCurrentBasicBlock()
+
+        positionAtEnd(slowBlock)
+        val slowOp = slow()
+        buildBr(endBlock)
+        val fromSlow = getCurrentBasicBlock()
+
+        positionAtEnd(endBlock)
+
+        return buildPhi(structValueP, listOf(fastOp, slowOp), listOf(fromFast, fromSlow))
+    }
+
+    // Natives and top-level procedures have no frame so their closures are literals.  They are entered directly with
+    // a trailing frame argument that, under the C calling convention, they simply ignore.
+    fun buildFromNativeProcedure(functionName: String, numberOfArguments: Int): LLVMValueRef =
+        module.addLiteralClosure(
+            getNamedFunction(functionName, List(numberOfArguments) { structValueP }, structValueP),
+            numberOfArguments,
+            getGenericFunction("_closure_argument_mismatch")
+        )
+
+    fun buildFromNativeVarArgProcedure(functionName: String): LLVMValueRef =
+        module.addLiteralClosure(
+            getNamedFunction(functionName, listOf(i32, structValuePP), structValueP),
+            -1,
+            getGenericFunction("_call_native_var_arg")
+        )
+
+    fun buildFromNativeVarArgPositionProcedure(functionName: String): LLVMValueRef =
+        module.addLiteralClosure(
+            getNamedFunction(functionName, listOf(i8P, i32, i32, structValuePP), structValueP),
+            -1,
+            getGenericFunction("_call_native_var_arg_position")
+        )
+
+    private fun getGenericFunction(name: String): LLVMValueRef =
+        getNamedFunction(name, listOf(i8P, i32, i32, structValuePP, structValueP), structValueP)
+
+    // The argv passed to natives taking a variable number of arguments: an array in this procedure's stack, or null
+    // when there are no arguments.
+    fun buildArgumentVector(arguments: List<LLVMValueRef>): LLVMValueRef =
+        if (arguments.isEmpty())
+            LLVM.LLVMConstPointerNull(structValuePP)
+        else {
+            val allocation = buildEntryAlloca(LLVM.LLVMArrayType(structValueP, arguments.size))
+            val items = LLVM.LLVMBuildBitCast(builder, allocation, structValuePP, "")
+
+            arguments.forEachIndexed { index, argument ->
+                buildStore(argument, LLVM.LLVMBuildGEP(builder, items, PointerPointer(LLVM.LLVMConstInt(i64, index.toLong(), 0)), 1, ""))
+            }
+            items
+        }
+
+    fun buildFromLiteralString(s: String): LLVMValueRef =
+        module.addLiteralString(s)
+
+    fun buildFromLiteralSymbol(name: String): LLVMValueRef =
+        buildLoad(module.addLiteralSymbol(name))
+
+    fun buildInternSymbol(name: LLVMValueRef): LLVMValueRef =
+        buildCall(getNamedFunction("_intern_symbol", listOf(structValueP), structValueP), listOf(name))
+
+    // Frames are accessed inline rather than through _get_frame_value and _set_frame_value so that loads and stores
+    // into a stack allocated frame remain visible to LLVM.
+    fun buildGetFrameValue(frame: LLVMValueRef, relativeDepth: Int, index: Int, name: String = ""): LLVMValueRef {
+        var ancestor = frame
+
+        repeat(relativeDepth) {
+            ancestor = buildLoad(buildFrameItem(ancestor, 0))
+        }
+
+        return buildLoad(buildFrameItem(ancestor, index), name)
+    }
+
+    private fun buildFrameItem(frame: LLVMValueRef, index: Int): LLVMValueRef =
+        LLVM.LLVMBuildGEP(
+            builder,
+            LLVM.LLVMBuildBitCast(builder, frame, LLVM.LLVMPointerType(context.structVector, 0), ""),
+            PointerPointer(c0i64, LLVM.LLVMConstInt(i32, 2, 0), LLVM.LLVMConstInt(i64, index.toLong(), 0)),
+            3,
+            ""
         )
 
     fun buildICmp(op: Int, lhs: LLVMValueRef, rhs: LLVMValueRef, name: String = ""): LLVMValueRef =
@@ -160,8 +376,8 @@ class FunctionBuilder(private val context: Context, private val module: Module,
     fun buildLoad(valueRef: LLVMValueRef, name: String = ""): LLVMValueRef =
         LLVM.LLVMBuildLoad(builder, valueRef, name)
 
-    private fun buildLoadNamedGlobal(globalName: String, name: String = ""): LLVMValueRef =
-        buildLoad(getNamedGlobal(globalName) ?: addGlobal(globalName, structValueP)!!, name)
+    fun buildLiteralPair(car: LLVMValueRef, cdr: LLVMValueRef): LLVMValueRef =
+        module.addLiteralPair(car, cdr)
 
     fun buildMkFrame(parentFrame: LLVMValueRef, size: Int, name: String = ""): LLVMValueRef =
         buildCall(
@@ -170,45 +386,181 @@ class FunctionBuilder(private val context: Context, private val module: Module,
             name
         )
 
+    // Allocates a frame on the native stack with the same layout and initial contents as _mk_frame.  bdwgc scans the
+    // stack conservatively so values held in the frame remain reachable.
+    fun buildStackFrame(parentFrame: LLVMValueRef, size: Int, name: String = ""): LLVMValueRef =
+        buildStackVector(listOf(parentFrame) + List(size) { context.cVNull }, name)
+
+    fun buildStackEnvironment(values: List<LLVMValueRef>, name: String = ""): LLVMValueRef =
+        buildStackVector(values, name)
+
+    fun buildMkEnvironment(values: List<LLVMValueRef>, name: String = ""): LLVMValueRef {
+        val environment = buildCall(
+            getNamedFunction("_mk_environment", listOf(i32), structValueP),
+            listOf(LLVM.LLVMConstInt(i32, values.size.toLong(), 0)),
+            name
+        )
+
+        values.forEachIndexed { index, value -> buildStore(value, buildFrameItem(environment, index)) }
+
+        return environment
+    }
+
+    // Allocas are placed at the start of the entry block so that each is allocated once per call however often the
+    // code that uses it runs, and so that LLVM can promote them to registers.
+    private fun buildEntryAlloca(type: LLVMTypeRef): LLVMValueRef {
+        val entryBuilder = LLVM.LLVMCreateBuilderInContext(context.context)
+        val entry = LLVM.LLVMGetEntryBasicBlock(procedure)
+        val first = LLVM.LLVMGetFirstInstruction(entry)
+
+        if (first == null)
+            LLVM.LLVMPositionBuilderAtEnd(entryBuilder, entry)
+        else
+            LLVM.LLVMPositionBuilderBefore(entryBuilder, first)
+
+        val allocation = LLVM.LLVMBuildAlloca(entryBuilder, type, "")
+        LLVM.LLVMSetAlignment(allocation, 8)
+        LLVM.LLVMDisposeBuilder(entryBuilder)
+
+        return allocation
+    }
+
+    private fun buildStackVector(items: List<LLVMValueRef>, name: String): LLVMValueRef {
+        val vectorType = LLVM.LLVMStructTypeInContext(
+            context.context,
+            PointerPointer(i32, i32, LLVM.LLVMArrayType(structValueP, items.size)),
+            3,
+            0
+        )
+        val allocation = buildEntryAlloca(vectorType)
+        val vector = LLVM.LLVMBuildBitCast(builder, allocation, structValueP, name)
+
+        buildStore(LLVM.LLVMConstInt(i32, FRAME_VALUE, 0), LLVM.LLVMBuildStructGEP(builder, allocation, 0, ""))
+        buildStore(LLVM.LLVMConstInt(i32, items.size.toLong(), 0), LLVM.LLVMBuildStructGEP(builder, allocation, 1, ""))
+        items.forEachIndexed { index, item -> buildStore(item, buildFrameItem(vector, index)) }
+
+        return vector
+    }
+
     fun buildPhi(type: LLVMTypeRef, incomingValues: List<LLVMValueRef>, incomingBlocks: List<LLVMBasicBlockRef>, name: String = ""): LLVMValueRef {
         val phi = LLVM.LLVMBuildPhi(builder, type, name)
         LLVM.LLVMAddIncoming(phi, pointerPointerOf(incomingValues), pointerPointerOf(incomingBlocks), incomingValues.size)
         return phi
     }
 
-    fun buildRet(v: LLVMValueRef): LLVMValueRef =
-        LLVM.LLVMBuildRet(builder, v)
+    fun buildRet(v: LLVMValueRef): LLVMValueRef {
+        buildProfileLeave()
+        return LLVM.LLVMBuildRet(builder, v)
+    }
 
-    fun buildSetFrameValue(frame: LLVMValueRef, index: Int, operand: LLVMValueRef): LLVMValueRef =
-        buildCall(
-            getNamedFunction("_set_frame_value", listOf(structValueP, i32, i32, structValueP), void),
-            listOf(frame, LLVM.LLVMConstInt(i32, 0.toLong(), 0), LLVM.LLVMConstInt(i32, index.toLong(), 0), operand),
-            ""
-        )
+    fun buildRetVoid(): LLVMValueRef =
+        LLVM.LLVMBuildRetVoid(builder)
 
-    fun buildStore(v1: LLVMValueRef, v2: LLVMValueRef) {
-        LLVM.LLVMBuildStore(builder, v1, v2)
+    // Returns the result of a call in tail position straight away so that the backend can turn the call into a jump.
+    // Anything built after this is unreachable.
+    fun buildTailCallReturn(call: LLVMValueRef): LLVMValueRef {
+        LLVM.LLVMSetTailCall(call, 1)
+        buildProfileLeaveBefore(call)
+        LLVM.LLVMBuildRet(builder, call)
+        positionAtEnd(appendBasicBlock())
+
+        return context.cVNull
     }
 
-    private fun buildNamedValue(valueName: String, name: String = ""): LLVMValueRef {
-        val result = getBindingValue(valueName)
+    // Pushes a frame naming this procedure onto the profiler's shadow stack.  The frame is popped by each return built
+    // after this and, as the callee takes over the caller's place, before each call in tail position.  The shadow
+    // stack is read by a signal handler so its stores are volatile to keep them in program order.
+    fun buildProfileEnter(name: String) {
+        val frame = buildEntryAlloca(context.structProfileFrame)
+        val top = module.getRuntimeGlobal("_profile_top", i8P)
+
+        buildVolatileStore(buildLoad(top), LLVM.LLVMBuildStructGEP(builder, frame, 0, ""))
+        buildVolatileStore(module.addProfileName(name), LLVM.LLVMBuildStructGEP(builder, frame, 1, ""))
+        buildVolatileStore(LLVM.LLVMConstInt(i32, 0, 0), LLVM.LLVMBuildStructGEP(builder, frame, 2, ""))
+        buildVolatileStore(LLVM.LLVMBuildBitCast(builder, frame, i8P, ""), top)
+        profileFrame = frame
+    }
 
-        return if (result == null) {
-            val newResult = buildLoadNamedGlobal(valueName, name)
-            addBindingToScope(valueName, newResult)
-            newResult
-        } else
-            result
+    // Has each call built after this record its position for the allocation profiler in lib.c.
+    fun enableAllocationSites(fileName: LLVMValueRef) {
+        allocationFileName = fileName
     }
 
-    fun buildVNull(name: String = ""): LLVMValueRef =
-        buildNamedValue("_VNull", name)
+    // Records the line of the call or closure about to be made in this procedure's shadow stack frame and as the site of
+    // the values it allocates.
+    fun buildSourceLine(lineNumber: Int) {
+        val line = LLVM.LLVMConstInt(i32, lineNumber.toLong(), 0)
+        val frame = profileFrame
+        val fileName = allocationFileName
+
+        if (frame != null)
+            buildVolatileStore(line, LLVM.LLVMBuildStructGEP(builder, frame, 2, ""))
+        if (fileName != null) {
+            buildStore(fileName, module.getRuntimeGlobal("_allocation_file_name", i8P))
+            buildStore(line, module.getRuntimeGlobal("_allocation_line_number", i32))
+        }
+    }
 
-    fun buildVTrue(name: String = ""): LLVMValueRef =
-        buildNamedValue("_VTrue", name)
+    private fun buildProfileLeave() {
+        val frame = profileFrame ?: return
+
+        buildVolatileStore(buildLoad(LLVM.LLVMBuildStructGEP(builder, frame, 0, "")), module.getRuntimeGlobal("_profile_top", i8P))
+    }
 
-    fun buildVFalse(name: String = ""): LLVMValueRef =
-        buildNamedValue("_VFalse", name)
+    private fun buildProfileLeaveBefore(call: LLVMValueRef) {
+        if (profileFrame == null)
+            return
+
+        LLVM.LLVMPositionBuilderBefore(builder, call)
+        buildProfileLeave()
+        LLVM.LLVMPositionBuilderAtEnd(builder, currentBasicBlock)
+    }
+
+    private fun buildVolatileStore(v1: LLVMValueRef, v2: LLVMValueRef) {
+        LLVM.LLVMSetVolatile(LLVM.LLVMBuildStore(builder, v1, v2), 1)
+    }
+
+    // Branches back to a loop header passing values into its phis.  Anything built after this is unreachable.
+    fun buildLoopBack(header: LLVMBasicBlockRef, phis: List<LLVMValueRef>, values: List<LLVMValueRef>): LLVMValueRef {
+        phis.zip(values).forEach { (phi, value) ->
+            LLVM.LLVMAddIncoming(phi, PointerPointer(value), PointerPointer(currentBasicBlock), 1)
+        }
+        buildBr(header)
+        positionAtEnd(appendBasicBlock())
+
+        return context.cVNull
+    }
+
+    fun isStackAllocated(value: LLVMValueRef): Boolean {
+        val operand = if (LLVM.LLVMIsABitCastInst(value) == null) value else LLVM.LLVMGetOperand(value, 0)
+
+        return LLVM.LLVMIsAAllocaInst(operand) != null
+    }
+
+    // A frame or box on the heap may have been allocated before the value stored into it, so a generational collector
+    // is told of the store.  Nothing allocates between allocating a frame and storing its parameters into it so those
+    // stores pass barrier as false.
+    fun buildSetFrameValue(frame: LLVMValueRef, index: Int, operand: LLVMValueRef, barrier: Boolean = true) {
+        buildStore(operand, buildFrameItem(frame, index))
+        if (barrier && !isStackAllocated(frame))
+            buildCall(
+                getNamedFunction("_gc_write_barrier", listOf(i8P), void),
+                listOf(LLVM.LLVMBuildBitCast(builder, frame, i8P, ""))
+            )
+    }
+
+    fun buildStore(v1: LLVMValueRef, v2: LLVMValueRef) {
+        LLVM.LLVMBuildStore(builder, v1, v2)
+    }
+
+    fun buildVNull(): LLVMValueRef =
+        context.cVNull
+
+    fun buildVTrue(): LLVMValueRef =
+        context.cVTrue
+
+    fun buildVFalse(): LLVMValueRef =
+        context.cVFalse
 
     fun positionAtEnd(basicBlock: LLVMBasicBlockRef) {
         LLVM.LLVMPositionBuilderAtEnd(builder, basicBlock)
@@ -226,14 +578,13 @@ class FunctionBuilder(private val context: Context, private val module: Module,
 
     val void get() = context.void
     val structValueP get() = context.structValueP
+    val structValuePP get() = context.structValuePP
     val i8 get() = context.i8
     val i8P get() = context.i8P
     val i32 get() = context.i32
+    val i64 get() = context.i64
     val c0i64 get() = context.c0i64
 
-    private fun addGlobal(name: String, type: LLVMTypeRef): LLVMValueRef? =
-        module.addGlobal(name, type)
-
     fun getNamedGlobal(name: String): LLVMValueRef? =
         module.getNamedGlobal(name)
 
@@ -246,9 +597,6 @@ class FunctionBuilder(private val context: Context, private val module: Module,
     private fun addExternalFunction(name: String, parameterTypes: List<LLVMTypeRef>, resultType: LLVMTypeRef, varArg: Boolean = false): LLVMValueRef =
         module.addExternalFunction(name, parameterTypes, resultType, varArg)
 
-    private fun addGlobalString(value: String): LLVMValueRef =
-        module.addGlobalString(value, "")
-
     fun openScope() =
         bindings.open()
 
@@ -1,8 +1,11 @@
 package io.littlelanguages.mil.compiler.llvm
 
 import org.bytedeco.javacpp.BytePointer
+import org.bytedeco.javacpp.IntPointer
 import org.bytedeco.javacpp.Pointer
 import org.bytedeco.javacpp.PointerPointer
+import org.bytedeco.llvm.LLVM.LLVMMemoryBufferRef
+import org.bytedeco.llvm.LLVM.LLVMModuleRef
 import org.bytedeco.llvm.LLVM.LLVMTypeRef
 import org.bytedeco.llvm.LLVM.LLVMValueRef
 import org.bytedeco.llvm.global.LLVM
@@ -94,6 +97,138 @@ class Module(val moduleID: String, private var context: Context) {
         }
     }
 
+    // Links the module in the bitcode file fileName into this module, so that the optimiser can inline its definitions
+    // into this module's code, and returns the error should it fail.  The optimiser only inlines a function into one
+    // that has at least its cpu features, so this module's functions are first marked with the cpu and features that
+    // the bitcode was compiled for.  A runtime compiled without exceptions is refused as, with its procedures marked
+    // nounwind, the optimiser would remove the handlers of every try.
+    fun linkBitcode(fileName: String): String? {
+        val buffer = LLVMMemoryBufferRef()
+        val error = BytePointer()
+
+        if (LLVM.LLVMCreateMemoryBufferWithContentsOfFile(fileName, buffer, error) != 0) {
+            val message = error.string
+            LLVM.LLVMDisposeMessage(error)
+            return "$fileName: $message"
+        }
+
+        val bitcode = LLVMModuleRef()
+        val parsed = LLVM.LLVMParseBitcodeInContext2(context.context, buffer, bitcode) == 0
+        LLVM.LLVMDisposeMemoryBuffer(buffer)
+
+        if (!parsed)
+            return "$fileName: invalid bitcode"
+
+        val exceptionThrow = LLVM.LLVMGetNamedFunction(bitcode, "_exception_throw")
+        val nounwind = LLVM.LLVMGetEnumAttributeKindForName("nounwind", "nounwind".length.toLong())
+        if (exceptionThrow != null && LLVM.LLVMGetEnumAttributeAtIndex(exceptionThrow, LLVM.LLVMAttributeFunctionIndex, nounwind) != null) {
+            LLVM.LLVMDisposeModule(bitcode)
+            return "$fileName: the runtime must be compiled with -fexceptions"
+        }
+
+        val definition = definedFunctions(bitcode).firstOrNull()
+        if (definition != null)
+            for (attribute in listOf("target-cpu", "target-features")) {
+                val value = stringAttribute(definition, attribute)
+
+                if (value != null)
+                    definedFunctions(module).forEach { LLVM.LLVMAddTargetDependentFunctionAttr(it, attribute, value) }
+            }
+
+        return if (LLVM.LLVMLinkModules2(module, bitcode) == 0) null else "$fileName: unable to link"
+    }
+
+    private fun definedFunctions(module: LLVMModuleRef): List<LLVMValueRef> {
+        val result = mutableListOf<LLVMValueRef>()
+        var function = LLVM.LLVMGetFirstFunction(module)
+
+        while (function != null) {
+            if (LLVM.LLVMIsDeclaration(function) == 0)
+                result.add(function)
+            function = LLVM.LLVMGetNextFunction(function)
+        }
+
+        return result
+    }
+
+    private fun stringAttribute(function: LLVMValueRef, name: String): String? {
+        val attribute = LLVM.LLVMGetStringAttributeAtIndex(function, LLVM.LLVMAttributeFunctionIndex, name, name.length) ?: return null
+        val length = IntPointer(1L)
+        val value = LLVM.LLVMGetStringAttributeValue(attribute, length)
+
+        return value.limit(length.get().toLong()).string
+    }
+
+    // Runs the new pass manager's standard pipeline for level over the module and returns the error should it fail.  The
+    // module takes its data layout from the target so that the passes know the sizes of its types.  Given a cpu, every
+    // function is marked with the cpu and its features, or the host's with "native", so that the code generated from the
+    // bitcode uses the cpu's instructions.
+    fun optimise(level: OptimisationLevel, cpu: String? = null): String? {
+        val (cpuName, features) = cpuNameAndFeatures(cpu)
+        val targetMachine =
+            try {
+                context.targetMachine(cpuName, features, level.codeGenLevel)
+            } catch (e: IllegalArgumentException) {
+                return e.message
+            }
+        val dataLayout = LLVM.LLVMCreateTargetDataLayout(targetMachine)
+
+        LLVM.LLVMSetModuleDataLayout(module, dataLayout)
+        LLVM.LLVMDisposeTargetData(dataLayout)
+
+        if (cpu != null)
+            definedFunctions(module).forEach {
+                LLVM.LLVMAddTargetDependentFunctionAttr(it, "target-cpu", cpuName)
+                if (features.isNotEmpty())
+                    LLVM.LLVMAddTargetDependentFunctionAttr(it, "target-features", features)
+            }
+
+        val options = LLVM.LLVMCreatePassBuilderOptions()
+        val error = LLVM.LLVMRunPasses(module, level.pipeline, targetMachine, options)
+
+        LLVM.LLVMDisposePassBuilderOptions(options)
+        LLVM.LLVMDisposeTargetMachine(targetMachine)
+
+        return if (error == null)
+            null
+        else {
+            val message = LLVM.LLVMGetErrorMessage(error)
+            val result = message.string
+            LLVM.LLVMDisposeErrorMessage(message)
+            result
+        }
+    }
+
+    // Writes the module's machine code for cpu, generated at level, to the object file fileName and returns the error
+    // should it fail.
+    fun writeObjectToFile(fileName: String, level: OptimisationLevel, cpu: String? = null): String? {
+        val (cpuName, features) = cpuNameAndFeatures(cpu)
+        val targetMachine =
+            try {
+                context.targetMachine(cpuName, features, level.codeGenLevel)
+            } catch (e: IllegalArgumentException) {
+                return e.message
+            }
+        val error = BytePointer()
+        val failed = LLVM.LLVMTargetMachineEmitToFile(targetMachine, module, BytePointer(fileName), LLVM.LLVMObjectFile, error) != 0
+
+        LLVM.LLVMDisposeTargetMachine(targetMachine)
+
+        return if (failed) {
+            val message = error.string
+            LLVM.LLVMDisposeMessage(error)
+            "$fileName: $message"
+        } else
+            null
+    }
+
+    private fun cpuNameAndFeatures(cpu: String?): Pair<String, String> =
+        when (cpu) {
+            null -> Pair("generic", "")
+            "native" -> hostCPU()
+            else -> Pair(cpu, "")
+        }
+
     fun writeBitcodeToFile(fileName: String) {
         LLVM.LLVMWriteBitcodeToFile(module, fileName)
     }
@@ -108,6 +243,97 @@ class Module(val moduleID: String, private var context: Context) {
         return globalStringName!!
     }
 
+    private val literalStrings = mutableMapOf<String, LLVMValueRef>()
+    private val literalPairs = mutableMapOf<Pair<LLVMValueRef, LLVMValueRef>, LLVMValueRef>()
+    private val literalClosures = mutableMapOf<String, LLVMValueRef>()
+    private val literalSymbols = mutableMapOf<String, LLVMValueRef>()
+    private val profileNames = mutableMapOf<String, LLVMValueRef>()
+
+    // Literal values are emitted once per module as read-only globals laid out as the heap values in lib.h.  They only
+    // ever refer to immediates or to other literal globals so bdwgc has no need to scan them as roots.
+    fun addLiteralString(value: String): LLVMValueRef =
+        literalStrings.getOrPut(value) {
+            val bytes = value.toByteArray()
+
+            addLiteral(
+                LLVM.LLVMConstStructInContext(
+                    context.context,
+                    PointerPointer(
+                        LLVM.LLVMConstInt(i32, STRING_VALUE, 0),
+                        LLVM.LLVMConstInt(i32, bytes.size.toLong(), 0),
+                        LLVM.LLVMConstStringInContext(context.context, BytePointer(*bytes), bytes.size, 0)
+                    ),
+                    3,
+                    0
+                )
+            )
+        }
+
+    fun addLiteralPair(car: LLVMValueRef, cdr: LLVMValueRef): LLVMValueRef =
+        literalPairs.getOrPut(Pair(car, cdr)) {
+            addLiteral(
+                LLVM.LLVMConstNamedStruct(
+                    context.structPair,
+                    PointerPointer(LLVM.LLVMConstInt(i32, PAIR_VALUE, 0), car, cdr),
+                    3
+                )
+            )
+        }
+
+    // Closures over procedures without a frame - natives and top-level procedures - are constants.
+    fun addLiteralClosure(entry: LLVMValueRef, numberOfArguments: Int, generic: LLVMValueRef): LLVMValueRef =
+        literalClosures.getOrPut(LLVM.LLVMGetValueName(entry).string) {
+            addLiteral(
+                LLVM.LLVMConstNamedStruct(
+                    context.structClosure,
+                    PointerPointer(
+                        LLVM.LLVMConstInt(i32, CLOSURE_VALUE, 0),
+                        LLVM.LLVMConstInt(i32, numberOfArguments.toLong(), 1),
+                        LLVM.LLVMConstBitCast(entry, i8P),
+                        LLVM.LLVMConstBitCast(generic, i8P),
+                        LLVM.LLVMConstPointerNull(structValueP)
+                    ),
+                    5
+                )
+            )
+        }
+
+    // A symbol must be interned at runtime so a literal symbol is a global that the module's _initialise_symbols sets
+    // to the interned symbol.  The global is writable and so a root for bdwgc.
+    fun addLiteralSymbol(name: String): LLVMValueRef =
+        literalSymbols.getOrPut(name) {
+            val global = addGlobal("", structValueP, LLVM.LLVMConstPointerNull(structValueP), false)
+
+            LLVM.LLVMSetLinkage(global, LLVM.LLVMPrivateLinkage)
+            global
+        }
+
+    fun literalSymbols(): Map<String, LLVMValueRef> =
+        literalSymbols
+
+    // The C string naming a procedure in the profiler's shadow stack.
+    fun addProfileName(name: String): LLVMValueRef =
+        profileNames.getOrPut(name) {
+            val bytes = name.toByteArray()
+            val global = addGlobal("", LLVM.LLVMArrayType(i8, bytes.size + 1), LLVM.LLVMConstStringInContext(context.context, BytePointer(*bytes), bytes.size, 0))
+
+            LLVM.LLVMSetLinkage(global, LLVM.LLVMPrivateLinkage)
+            LLVM.LLVMConstBitCast(global, i8P)
+        }
+
+    // A variable defined by the runtime such as the top of the profiler's shadow stack.
+    fun getRuntimeGlobal(name: String, type: LLVMTypeRef): LLVMValueRef =
+        getNamedGlobal(name) ?: addGlobal(name, type, false)!!
+
+    private fun addLiteral(init: LLVMValueRef): LLVMValueRef {
+        val global = addGlobal("", LLVM.LLVMTypeOf(init), init)
+
+        LLVM.LLVMSetLinkage(global, LLVM.LLVMPrivateLinkage)
+        LLVM.LLVMSetAlignment(global, 8)
+
+        return LLVM.LLVMConstBitCast(global, structValueP)
+    }
+
     val void get() = context.void
     val structValueP get() = context.structValueP
     val i8 get() = context.i8
@@ -132,3 +358,12 @@ fun <T : Pointer?> pointerPointerOf(elements: List<T>): PointerPointer<T> {
 
     return result
 }
+
+// The new pass manager's standard pipelines and the code generation level that goes with each.
+enum class OptimisationLevel(val pipeline: String, val codeGenLevel: Int) {
+    O0("default<O0>", LLVM.LLVMCodeGenLevelNone),
+    O1("default<O1>", LLVM.LLVMCodeGenLevelLess),
+    O2("default<O2>", LLVM.LLVMCodeGenLevelDefault),
+    O3("default<O3>", LLVM.LLVMCodeGenLevelAggressive),
+    Os("default<Os>", LLVM.LLVMCodeGenLevelDefault)
+}
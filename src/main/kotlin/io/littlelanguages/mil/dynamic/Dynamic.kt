@@ -90,7 +90,7 @@ private class Translator<S, T>(builtinBindings: List<Binding<S, T>>, val ast: io
             is io.littlelanguages.mil.static.ast.SExpression -> {
                 val first = e.expressions[0]
 
-                if (first is io.littlelanguages.mil.static.ast.Symbol) {
+                if (first is io.littlelanguages.mil.static.ast.Symbol && !isLiteralSymbol(first)) {
                     val arguments = e.expressions.drop(1).map { expressionToTST(it) }
 
                     when (val binding = bindings.get(first.name)) {
@@ -138,15 +138,15 @@ private class Translator<S, T>(builtinBindings: List<Binding<S, T>>, val ast: io
                 listOf(SignalExpression(expressionsToTST(e.expression), lineNumber(e.position)))
 
             is io.littlelanguages.mil.static.ast.TryExpression -> {
-                val body = procedureToTST(nextName(), emptyList(), e.body)
+                val body = expressionsToTST(e.body)
                 val catch = expressionsToTST(e.catch)
 
                 if (!isProcedure(catch))
                     reportError(ExpressionNotProcedureError(e.catch.drop(1).fold(e.catch[0].position) { a, b -> a + b.position }))
                 else
-                    listOf(body.first) + catch.dropLast(1) + listOf(
+                    catch.dropLast(1) + listOf(
                         TryExpression(
-                            SymbolReferenceExpression(body.second, lineNumber(e.position)),
+                            body,
                             catch.last() as SymbolReferenceExpression<S, T>,
                             lineNumber(e.position)
                         )
@@ -156,7 +156,9 @@ private class Translator<S, T>(builtinBindings: List<Binding<S, T>>, val ast: io
             is io.littlelanguages.mil.static.ast.Symbol -> {
                 val binding = bindings.get(e.name)
 
-                if (binding == null)
+                if (isLiteralSymbol(e))
+                    listOf(LiteralSymbol(e.name.drop(1)))
+                else if (binding == null)
                     reportError(UnknownSymbolError(e.name, e.position))
                 else
                     listOf(SymbolReferenceExpression(binding, lineNumber(e.position)))
@@ -263,6 +265,10 @@ fun <S, T> translateLiteralString(e: io.littlelanguages.mil.static.ast.LiteralSt
     }
 }
 
+// The scanner accepts a quote within a symbol so a quoted symbol such as 'hello is a symbol literal.
+private fun isLiteralSymbol(e: io.littlelanguages.mil.static.ast.Symbol): Boolean =
+    e.name.length > 1 && e.name[0] == '\''
+
 private fun Char.isHexDigit(): Boolean =
     this.isDigit() || this.uppercaseChar() in 'A'..'F'
 
@@ -0,0 +1,77 @@
+package io.littlelanguages.mil.dynamic.tst
+
+import io.littlelanguages.mil.dynamic.DeclaredProcedureBinding
+
+enum class FrameAllocation {
+    // The procedure has no nested procedures and no local values so nothing ever refers to its frame.
+    NONE,
+
+    // The frame is only reachable while the procedure is active so it can live on the native stack.
+    STACK,
+
+    // The frame is captured by a closure and must be allocated on the GC heap.
+    HEAP
+}
+
+// A closure over a procedure declared at depth q holds on to the frames of its enclosing procedures - those at depths
+// 0 until q.  The frame of a procedure at depth p therefore escapes when its body, including the bodies of procedures
+// nested within it, references a procedure at a depth greater than p as a value.  A try's handler is not such a
+// reference when it is called directly from the try's landing pad.
+fun <S, T> frameAllocation(procedure: Procedure<S, T>): FrameAllocation =
+    when {
+        capturesFrame(procedure.depth, procedure.es) ->
+            FrameAllocation.HEAP
+
+        hasNestedProcedure(procedure) || procedure.offsets > procedure.parameters.size ->
+            FrameAllocation.STACK
+
+        else ->
+            FrameAllocation.NONE
+    }
+
+fun <S, T> hasNestedProcedure(procedure: Procedure<S, T>): Boolean =
+    procedure.es.any { e -> expressions(e).any { it is Procedure } }
+
+// A handler that is a declared procedure taking the exception is called directly rather than through a closure.
+fun <S, T> callsHandlerDirectly(e: TryExpression<S, T>): Boolean {
+    val handler = e.catch.symbol
+
+    return handler is DeclaredProcedureBinding && handler.parameterCount == 1
+}
+
+private fun <S, T> capturesFrame(depth: Int, es: Expressions<S, T>): Boolean =
+    es.any { e ->
+        expressions(e, false).any {
+            it is SymbolReferenceExpression && it.symbol is DeclaredProcedureBinding && (it.symbol as DeclaredProcedureBinding).depth > depth
+        }
+    }
+
+// All the expressions within e, e included, descending into nested procedures.  Handlers that are called directly are
+// left out unless includeHandlers is set.
+internal fun <S, T> expressions(e: Expression<S, T>, includeHandlers: Boolean = true): Sequence<Expression<S, T>> =
+    sequenceOf(e) + when (e) {
+        is AssignExpression ->
+            e.es.asSequence().flatMap { expressions(it, includeHandlers) }
+
+        is CallProcedureExpression ->
+            e.es.asSequence().flatten().flatMap { expressions(it, includeHandlers) }
+
+        is CallValueExpression ->
+            (e.operand + e.es).asSequence().flatMap { expressions(it, includeHandlers) }
+
+        is IfExpression ->
+            (e.e1 + e.e2 + e.e3).asSequence().flatMap { expressions(it, includeHandlers) }
+
+        is Procedure ->
+            e.es.asSequence().flatMap { expressions(it, includeHandlers) }
+
+        is SignalExpression ->
+            e.e.asSequence().flatMap { expressions(it, includeHandlers) }
+
+        is TryExpression ->
+            e.body.asSequence().flatMap { expressions(it, includeHandlers) } +
+                    if (includeHandlers || !callsHandlerDirectly(e)) sequenceOf(e.catch) else emptySequence()
+
+        else ->
+            emptySequence()
+    }
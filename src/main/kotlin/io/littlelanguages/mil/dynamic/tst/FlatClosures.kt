@@ -0,0 +1,107 @@
+package io.littlelanguages.mil.dynamic.tst
+
+import io.littlelanguages.mil.dynamic.Binding
+import io.littlelanguages.mil.dynamic.DeclaredProcedureBinding
+import io.littlelanguages.mil.dynamic.ParameterBinding
+import io.littlelanguages.mil.dynamic.ProcedureValueBinding
+
+// Closure conversion for the flat closure compilation mode.  Rather than being passed its parent's frame, a nested
+// procedure is passed an environment holding just the variables of its enclosing procedures that it refers to - its
+// free variables.
+//
+// A procedure needs the free variables of every procedure that it calls or closes over, so these sets are computed as
+// a fixpoint.  Variables are identified by their bindings: the enclosing procedures of any procedure are at distinct
+// depths so a binding's name, depth and offset are unique within a single environment.
+//
+// Values are never reassigned so environments hold copies.  The exception is a value captured by a closure created
+// while evaluating its own initialiser: that closure would copy () so the value is boxed and the closure holds the box.
+class FlatClosures<S, T>(program: Program<S, T>) {
+    private val procedures = mutableMapOf<String, Procedure<S, T>>()
+    private val freeVariables: Map<String, List<Binding<S, T>>>
+    private val boxed = mutableSetOf<Binding<S, T>>()
+
+    init {
+        program.declarations.forEach { if (it is Procedure) addProcedures(it) }
+
+        val callees = procedures.mapValues { (_, procedure) ->
+            procedure.es.flatMap { e -> expressions(e).mapNotNull { referencedProcedure(it) }.toList() }.toSet()
+        }
+        val variables = procedures.mapValues { (_, procedure) ->
+            procedure.es.flatMap { e -> expressions(e).mapNotNull { referencedVariable(it) }.filter { depth(it) < procedure.depth }.toList() }
+                .toMutableSet()
+        }
+
+        do {
+            var changed = false
+
+            procedures.forEach { (name, procedure) ->
+                callees[name]!!.forEach { callee ->
+                    variables[callee]?.toList()?.forEach {
+                        if (depth(it) < procedure.depth && variables[name]!!.add(it))
+                            changed = true
+                    }
+                }
+            }
+        } while (changed)
+
+        freeVariables = variables.mapValues { (_, vs) -> vs.sortedWith(compareBy({ depth(it) }, { offset(it) })) }
+
+        procedures.values.forEach { procedure ->
+            procedure.es.forEach { e ->
+                expressions(e).filterIsInstance<AssignExpression<S, T>>().forEach { assignment ->
+                    if (assignment.es.any { initialiser -> expressions(initialiser).any { closesOver(assignment, it) } })
+                        boxed.add(assignment.symbol)
+                }
+            }
+        }
+    }
+
+    fun freeVariables(procedureName: String): List<Binding<S, T>> =
+        freeVariables[procedureName] ?: emptyList()
+
+    fun isBoxed(binding: Binding<S, T>): Boolean =
+        boxed.contains(binding)
+
+    private fun addProcedures(procedure: Procedure<S, T>) {
+        procedures[procedure.name] = procedure
+        procedure.es.forEach { e -> expressions(e).forEach { if (it is Procedure && it !== procedure) procedures[it.name] = it } }
+    }
+
+    private fun closesOver(assignment: AssignExpression<S, T>, e: Expression<S, T>): Boolean {
+        val symbol = if (e is SymbolReferenceExpression) e.symbol else null
+
+        return symbol is DeclaredProcedureBinding && symbol.depth > 0 && freeVariables(symbol.name).contains(assignment.symbol)
+    }
+}
+
+private fun <S, T> referencedProcedure(e: Expression<S, T>): String? =
+    when {
+        e is SymbolReferenceExpression && e.symbol is DeclaredProcedureBinding ->
+            e.symbol.name
+
+        e is CallProcedureExpression && e.procedure is DeclaredProcedureBinding ->
+            e.procedure.name
+
+        else ->
+            null
+    }
+
+private fun <S, T> referencedVariable(e: Expression<S, T>): Binding<S, T>? =
+    if (e is SymbolReferenceExpression && (e.symbol is ParameterBinding || e.symbol is ProcedureValueBinding))
+        e.symbol
+    else
+        null
+
+private fun <S, T> depth(binding: Binding<S, T>): Int =
+    when (binding) {
+        is ParameterBinding -> binding.depth
+        is ProcedureValueBinding -> binding.depth
+        else -> -1
+    }
+
+private fun <S, T> offset(binding: Binding<S, T>): Int =
+    when (binding) {
+        is ParameterBinding -> binding.offset
+        is ProcedureValueBinding -> binding.offset
+        else -> -1
+    }
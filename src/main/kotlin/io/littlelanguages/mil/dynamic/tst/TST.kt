@@ -90,11 +90,11 @@ data class SymbolReferenceExpression<S, T>(val symbol: Binding<S, T>, val lineNu
         symbol.yaml()
 }
 
-data class TryExpression<S, T>(val body: SymbolReferenceExpression<S, T>, val catch: SymbolReferenceExpression<S, T>, val lineNumber: Int) : Expression<S, T> {
+data class TryExpression<S, T>(val body: Expressions<S, T>, val catch: SymbolReferenceExpression<S, T>, val lineNumber: Int) : Expression<S, T> {
     override fun yaml(): Any =
         singletonMap(
             "try", mapOf(
-                Pair("body", body.yaml()),
+                Pair("body", body.map { it.yaml() }),
                 Pair("catch", catch.yaml())
             )
         )
@@ -110,6 +110,11 @@ data class LiteralString<S, T>(val value: String) : Expression<S, T> {
         value
 }
 
+data class LiteralSymbol<S, T>(val name: String) : Expression<S, T> {
+    override fun yaml(): Any =
+        "'$name"
+}
+
 class LiteralUnit<S, T> : Expression<S, T> {
     override fun yaml(): Any = "()"
 }
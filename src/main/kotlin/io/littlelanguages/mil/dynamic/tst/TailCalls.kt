@@ -0,0 +1,18 @@
+package io.littlelanguages.mil.dynamic.tst
+
+import io.littlelanguages.mil.dynamic.DeclaredProcedureBinding
+
+// The expressions of a body whose value is the body's value: the last expression and, when that is an if, the tail
+// expressions of each of its branches.
+fun <S, T> tailExpressions(es: Expressions<S, T>): Sequence<Expression<S, T>> {
+    val e = es.lastOrNull() ?: return emptySequence()
+
+    return sequenceOf(e) + if (e is IfExpression) tailExpressions(e.e2) + tailExpressions(e.e3) else emptySequence()
+}
+
+fun <S, T> isSelfTailCall(procedure: Procedure<S, T>, e: Expression<S, T>): Boolean =
+    e is CallProcedureExpression && e.procedure is DeclaredProcedureBinding && e.procedure.name == procedure.name
+
+// A procedure that calls itself in tail position is compiled as a loop.
+fun <S, T> hasSelfTailCall(procedure: Procedure<S, T>): Boolean =
+    tailExpressions(procedure.es).any { isSelfTailCall(procedure, it) }
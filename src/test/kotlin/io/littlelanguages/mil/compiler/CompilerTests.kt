@@ -7,6 +7,8 @@ import io.littlelanguages.data.Either
 import io.littlelanguages.data.Left
 import io.littlelanguages.data.Right
 import io.littlelanguages.mil.Errors
+import io.littlelanguages.mil.bin.CLI
+import io.littlelanguages.mil.bin.link
 import io.littlelanguages.mil.compiler.llvm.Context
 import io.littlelanguages.mil.compiler.llvm.Module
 import io.littlelanguages.mil.compiler.llvm.targetTriple
@@ -16,6 +18,7 @@ import io.littlelanguages.mil.static.Scanner
 import io.littlelanguages.mil.static.parse
 import org.bytedeco.llvm.LLVM.LLVMValueRef
 import org.yaml.snakeyaml.Yaml
+import picocli.CommandLine
 import java.io.*
 
 
@@ -34,16 +37,110 @@ class CompilerTests : FunSpec({
 
         context.dispose()
     }
+
+    context("Conformance Tests with Flat Closures") {
+        val context = Context(targetTriple())
+        val content = File("./src/test/kotlin/io/littlelanguages/mil/compiler/compiler.yaml").readText()
+
+        val scenarios: Any = yaml.load(content)
+
+        if (scenarios is List<*>) {
+            parserConformanceTest(builtinBindings, context, this, scenarios, CompileOptions(flatClosures = true))
+        }
+
+        context.dispose()
+    }
+
+    context("Conformance Tests with Profiling") {
+        val context = Context(targetTriple())
+        val content = File("./src/test/kotlin/io/littlelanguages/mil/compiler/compiler.yaml").readText()
+
+        val scenarios: Any = yaml.load(content)
+
+        if (scenarios is List<*>) {
+            parserConformanceTest(builtinBindings, context, this, scenarios, CompileOptions(profile = true, profileAllocations = true))
+        }
+
+        context.dispose()
+    }
+
+    context("Conformance Tests with the Runtime Linked") {
+        val context = Context(targetTriple())
+        val content = File("./src/test/kotlin/io/littlelanguages/mil/compiler/compiler.yaml").readText()
+
+        val scenarios: Any = yaml.load(content)
+
+        if (scenarios is List<*>) {
+            parserConformanceTest(builtinBindings, context, this, scenarios, CompileOptions(runtime = File("src/main/c/lib.bc").absolutePath))
+        }
+
+        context.dispose()
+    }
+
+    // nursery.c is built only on Linux.  The smallest nursery collects every 64KB allocated so that the older values the
+    // write barriers record are reached by many minor collections.
+    if (System.getProperty("os.name") == "Linux") {
+        context("Conformance Tests with the Nursery Collector") {
+            val context = Context(targetTriple())
+            val content = File("./src/test/kotlin/io/littlelanguages/mil/compiler/compiler.yaml").readText()
+
+            val scenarios: Any = yaml.load(content)
+
+            if (scenarios is List<*>) {
+                parserConformanceTest(builtinBindings, context, this, scenarios, collector = "src/main/c/nursery.o", environment = mapOf("MIL_NURSERY_SIZE" to "65536"))
+
+                context("Emitting Objects") {
+                    parserConformanceTest(
+                        builtinBindings, context, this, scenarios, emitObject = true,
+                        collector = "src/main/c/nursery.o", environment = mapOf("MIL_NURSERY_SIZE" to "65536")
+                    )
+                }
+            }
+
+            context.dispose()
+        }
+    }
+
+    context("Conformance Tests Emitting Objects") {
+        val context = Context(targetTriple())
+        val content = File("./src/test/kotlin/io/littlelanguages/mil/compiler/compiler.yaml").readText()
+
+        val scenarios: Any = yaml.load(content)
+
+        if (scenarios is List<*>) {
+            parserConformanceTest(builtinBindings, context, this, scenarios, emitObject = true)
+
+            context("with the Runtime Linked") {
+                parserConformanceTest(builtinBindings, context, this, scenarios, CompileOptions(runtime = File("src/main/c/lib.bc").absolutePath), emitObject = true)
+            }
+        }
+
+        test("--emit executable with --runtime") {
+            File("test.mlsp").writeText("(println (try (/ 1 0) (proc (e) e)))\n")
+
+            CommandLine(CLI()).execute(
+                "--emit", "executable", "--runtime", "src/main/c/lib.bc", "-o", "test.bin",
+                "-l", "src/main/c/libmil.a", "-l", "bdwgc/gc.a", "test.mlsp"
+            ) shouldBe 0
+            runCommand(arrayOf("./test.bin")) shouldBe "(DivideByZero test.mlsp 1)"
+        }
+
+        context.dispose()
+    }
 })
 
-fun compile(builtinBindings: List<Binding<CompileState, LLVMValueRef>>, context: Context, input: String): Either<List<Errors>, Module> =
-    parse(Scanner(StringReader(input))) mapLeft { listOf(it) } andThen { translate(builtinBindings, it) } andThen { compile(context, "./test.mlsp", it) }
+fun compile(builtinBindings: List<Binding<CompileState, LLVMValueRef>>, context: Context, input: String, options: CompileOptions = CompileOptions()): Either<List<Errors>, Module> =
+    parse(Scanner(StringReader(input))) mapLeft { listOf(it) } andThen { translate(builtinBindings, it) } andThen { compile(context, "./test.mlsp", it, options) }
 
 suspend fun parserConformanceTest(
     builtinBindings: List<Binding<CompileState, LLVMValueRef>>,
     context: Context,
     ctx: FunSpecContainerContext,
-    scenarios: List<*>
+    scenarios: List<*>,
+    options: CompileOptions = CompileOptions(),
+    emitObject: Boolean = false,
+    collector: String = "bdwgc/gc.a",
+    environment: Map<String, String> = emptyMap()
 ) {
     scenarios.forEach { scenario ->
         val s = scenario as Map<*, *>
@@ -55,7 +152,7 @@ suspend fun parserConformanceTest(
             val output = s["output"]
 
             ctx.test(name) {
-                val lhs = when (val llvmState = compile(builtinBindings, context, input)) {
+                val lhs = when (val llvmState = compile(builtinBindings, context, input, options)) {
                     is Left ->
                         llvmState.left.joinToString("")
 
@@ -64,9 +161,15 @@ suspend fun parserConformanceTest(
 
 //                        LLVM.LLVMDumpModule(module)
 //                        System.err.println(LLVM.LLVMPrintModuleToString(module).string)
-                        module.writeBitcodeToFile("test.bc")
-                        runCommand(arrayOf("clang", "test.bc", "src/main/c/lib.o", "./src/main/c/main.o", "./bdwgc/gc.a", "-o", "test.bin"))
-                        val commandOutput = runCommand(arrayOf("./test.bin"))
+                        if (emitObject) {
+                            module.writeObjectToFile("test.o", options.optimisation, options.targetCPU) shouldBe null
+                            link("cc", File("test.o"), listOf(File("src/main/c/libmil.a"), File(collector)), File("test.bin")) shouldBe null
+                        } else {
+                            module.writeBitcodeToFile("test.bc")
+                            val runtime = if (options.runtime == null) listOf("src/main/c/lib.o") else emptyList()
+                            runCommand((listOf("clang", "test.bc") + runtime + listOf("./src/main/c/main.o", collector, "-o", "test.bin")).toTypedArray())
+                        }
+                        val commandOutput = runCommand(arrayOf("./test.bin"), environment)
 
                         module.dispose()
 
@@ -83,15 +186,16 @@ suspend fun parserConformanceTest(
             val name = nestedScenario["name"] as String
             val tests = nestedScenario["tests"] as List<*>
             ctx.context(name) {
-                parserConformanceTest(builtinBindings, context, this, tests)
+                parserConformanceTest(builtinBindings, context, this, tests, options, emitObject, collector, environment)
             }
         }
     }
 }
 
-private fun runCommand(commands: Array<String>): String {
+private fun runCommand(commands: Array<String>, environment: Map<String, String> = emptyMap()): String {
     val rt = Runtime.getRuntime()
-    val proc = rt.exec(commands)
+    val envp = if (environment.isEmpty()) null else (System.getenv() + environment).map { "${it.key}=${it.value}" }.toTypedArray()
+    val proc = rt.exec(commands, envp)
 
     val sb = StringBuffer()
 
@@ -7,7 +7,9 @@ import io.littlelanguages.data.Either
 import io.littlelanguages.data.Left
 import io.littlelanguages.data.Right
 import io.littlelanguages.mil.Errors
+import io.littlelanguages.mil.dynamic.tst.Expression
 import io.littlelanguages.mil.dynamic.tst.Expressionss
+import io.littlelanguages.mil.dynamic.tst.Procedure
 import io.littlelanguages.mil.dynamic.tst.Program
 import io.littlelanguages.mil.static.Scanner
 import io.littlelanguages.mil.static.parse
@@ -40,15 +42,39 @@ class DynamicTests : FunSpec({
     }
 })
 
-private class DummyVariableArityExternalProcedure(
+internal class DummyVariableArityExternalProcedure(
     override val name: String
 ) : ExternalProcedureBinding<S, T>(name, null) {
     override fun compile(state: S, lineNumber: Int, arguments: Expressionss<S, T>): T? = null
 }
 
+// The builtins available to the tests that analyse translated procedures
+internal val analysisBindings: List<Binding<S, T>> = listOf(
+    DummyVariableArityExternalProcedure("+"),
+    DummyVariableArityExternalProcedure("<"),
+    DummyVariableArityExternalProcedure("println")
+)
+
 fun translate(builtinBindings: List<Binding<S, T>>, input: String): Either<List<Errors>, Program<S, T>> =
     parse(Scanner(StringReader(input))) mapLeft { listOf(it) } andThen { translate(builtinBindings, it) }
 
+// Translates input with analysisBindings and returns its procedures, nested procedures included, by name
+internal fun procedures(input: String): Map<String, Procedure<S, T>> {
+    val program = (translate(analysisBindings, input) as Right).right
+    val result = mutableMapOf<String, Procedure<S, T>>()
+
+    fun visit(e: Expression<S, T>) {
+        if (e is Procedure) {
+            result[e.name] = e
+            e.es.forEach { visit(it) }
+        }
+    }
+
+    program.declarations.forEach { if (it is Procedure) visit(it) }
+
+    return result
+}
+
 suspend fun parserConformanceTest(builtinBindings: List<Binding<S, T>>, ctx: FunSpecContainerContext, scenarios: List<*>) {
     scenarios.forEach { scenario ->
         val s = scenario as Map<*, *>
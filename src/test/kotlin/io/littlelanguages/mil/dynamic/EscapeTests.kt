@@ -0,0 +1,84 @@
+package io.littlelanguages.mil.dynamic
+
+import io.kotest.core.spec.style.FunSpec
+import io.kotest.matchers.shouldBe
+import io.littlelanguages.mil.dynamic.tst.*
+
+private fun allocations(input: String): Map<String, FrameAllocation> =
+    procedures(input).mapValues { frameAllocation(it.value) }
+
+class EscapeTests : FunSpec({
+    test("procedure without nested procedures or values needs no frame") {
+        allocations("(const (inc n) (+ n 1))")["inc"] shouldBe FrameAllocation.NONE
+    }
+
+    test("procedure with local values uses a stack frame") {
+        allocations("(const (inc n) (const m (+ n 1)) m)")["inc"] shouldBe FrameAllocation.STACK
+    }
+
+    test("procedure whose nested procedure is only called uses a stack frame") {
+        val result = allocations(
+            """
+            (const (f a b)
+              (const (g x) (+ a b x))
+              (g 1)
+            )
+            """
+        )
+
+        result["f"] shouldBe FrameAllocation.STACK
+        result["g"] shouldBe FrameAllocation.NONE
+    }
+
+    test("procedure returning a nested procedure uses a heap frame") {
+        val result = allocations(
+            """
+            (const (adder a)
+              (const (add b) (+ a b))
+              add
+            )
+            """
+        )
+
+        result["adder"] shouldBe FrameAllocation.HEAP
+        result["add"] shouldBe FrameAllocation.NONE
+    }
+
+    test("referencing a sibling as a value captures only the enclosing frame") {
+        val result = allocations(
+            """
+            (const (f a)
+              (const (g x) (+ a x))
+              (const (h y) (println g) y)
+              (h a)
+            )
+            """
+        )
+
+        result["f"] shouldBe FrameAllocation.HEAP
+        result["g"] shouldBe FrameAllocation.NONE
+        result["h"] shouldBe FrameAllocation.NONE
+    }
+
+    test("lambda within a nested procedure captures every enclosing frame") {
+        val result = allocations(
+            """
+            (const (f a)
+              (const (g x) (proc (y) (+ a x y)))
+              (g 1)
+            )
+            """
+        )
+
+        result["f"] shouldBe FrameAllocation.HEAP
+        result["g"] shouldBe FrameAllocation.HEAP
+    }
+
+    test("try handler called from the landing pad does not capture the frame") {
+        allocations("(const (f a) (try (+ a 1) (proc (e) a)))")["f"] shouldBe FrameAllocation.STACK
+    }
+
+    test("try body creating a closure captures the frame") {
+        allocations("(const (f a) (try (proc (x) (+ a x)) (proc (e) 0)))")["f"] shouldBe FrameAllocation.HEAP
+    }
+})
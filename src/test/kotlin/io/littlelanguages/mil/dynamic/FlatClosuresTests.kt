@@ -0,0 +1,77 @@
+package io.littlelanguages.mil.dynamic
+
+import io.kotest.core.spec.style.FunSpec
+import io.kotest.matchers.shouldBe
+import io.littlelanguages.data.Right
+import io.littlelanguages.mil.dynamic.tst.*
+
+private fun flatClosures(input: String): FlatClosures<S, T> =
+    FlatClosures((translate(analysisBindings, input) as Right).right)
+
+private fun FlatClosures<S, T>.freeNames(procedureName: String): List<String> =
+    freeVariables(procedureName).map { it.name }
+
+class FlatClosuresTests : FunSpec({
+    test("top-level procedure has no free variables") {
+        flatClosures("(const (inc n) (+ n 1))").freeNames("inc") shouldBe emptyList()
+    }
+
+    test("nested procedure captures only the variables it refers to") {
+        val closures = flatClosures(
+            """
+            (const (f a b)
+              (const c (+ a b))
+              (const (g x) (+ c x))
+              (g 1)
+            )
+            """
+        )
+
+        closures.freeNames("g") shouldBe listOf("c")
+    }
+
+    test("nested procedure captures the free variables of the procedures it calls") {
+        val closures = flatClosures(
+            """
+            (const (f a b)
+              (const (g x) (+ a x))
+              (const (h y) (g (+ b y)))
+              (h 1)
+            )
+            """
+        )
+
+        closures.freeNames("g") shouldBe listOf("a")
+        closures.freeNames("h") shouldBe listOf("a", "b")
+    }
+
+    test("lambda captures variables from every enclosing procedure") {
+        val closures = flatClosures(
+            """
+            (const (f a)
+              (const (g x) (proc (y) (+ a x y)))
+              (g 1)
+            )
+            """
+        )
+
+        closures.freeNames("g") shouldBe listOf("a")
+    }
+
+    test("value captured by its own initialiser is boxed") {
+        val program = (translate(
+            analysisBindings,
+            """
+            (const (f n)
+              (const m (+ n 1))
+              (const g (proc (i) (g i)))
+              (g m)
+            )
+            """
+        ) as Right).right
+        val closures = FlatClosures(program)
+        val assignments = program.declarations.filterIsInstance<Procedure<S, T>>().first { it.name == "f" }.es.filterIsInstance<AssignExpression<S, T>>()
+
+        assignments.map { closures.isBoxed(it.symbol) } shouldBe listOf(false, true)
+    }
+})
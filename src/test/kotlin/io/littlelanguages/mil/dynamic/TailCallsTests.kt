@@ -0,0 +1,39 @@
+package io.littlelanguages.mil.dynamic
+
+import io.kotest.core.spec.style.FunSpec
+import io.kotest.matchers.shouldBe
+import io.littlelanguages.mil.dynamic.tst.*
+
+class TailCallsTests : FunSpec({
+    test("self call in an if branch is a tail call") {
+        val count = procedures("(const (count n) (if (< n 1) 0 (count (+ n 1))))")["count"]!!
+
+        hasSelfTailCall(count) shouldBe true
+    }
+
+    test("self call as an argument is not a tail call") {
+        val length = procedures("(const (length n) (if (< n 1) 0 (+ 1 (length (+ n 1)))))")["length"]!!
+
+        hasSelfTailCall(length) shouldBe false
+    }
+
+    test("self call in an if condition is not a tail call") {
+        val f = procedures("(const (f n) (if (f n) 0 1))")["f"]!!
+
+        hasSelfTailCall(f) shouldBe false
+    }
+
+    test("nested procedure calling itself in tail position") {
+        val result = procedures(
+            """
+            (const (f a)
+              (const (loop n) (if (< a n) n (loop (+ n 1))))
+              (loop 0)
+            )
+            """
+        )
+
+        hasSelfTailCall(result["f"]!!) shouldBe false
+        hasSelfTailCall(result["loop"]!!) shouldBe true
+    }
+})